@@ -0,0 +1,162 @@
+#include "AutoFocus.h"
+#include <algorithm>
+#include <cmath>
+#include "DepthRange.h"
+
+using namespace std;
+
+AutoFocus::AutoFocus(){
+}
+
+AutoFocus::~AutoFocus(){
+	{
+		lock_guard<mutex> lock(guard);
+		quit = true;
+	}
+	wake.notify_one();
+	if (worker.joinable())
+		worker.join();
+}
+
+void AutoFocus::setPercentile(float p){
+	lock_guard<mutex> lock(guard);
+	percentile = min(max(p, 0.f), 50.f);
+}
+
+void AutoFocus::setPoint(int x, int y){
+	lock_guard<mutex> lock(guard);
+	pointX = x;
+	pointY = y;
+}
+
+void AutoFocus::setTimeConstant(float seconds){
+	timeConstant = max(seconds, 0.f);
+}
+
+void AutoFocus::submit(const float* depth, unsigned int width, unsigned int height, const Camera& camera){
+	{
+		lock_guard<mutex> lock(guard);
+		if (!worker.joinable())
+			worker = thread(&AutoFocus::workerLoop, this);
+		pending.assign(depth, depth + width * height);
+		pendingWidth = width;
+		pendingHeight = height;
+		pendingCamera = camera;
+		hasPending = true;
+	}
+	wake.notify_one();
+}
+
+//the lock is only tried: when the thread holds it, the statistics are picked up next frame
+bool AutoFocus::update(float dt){
+	{
+		unique_lock<mutex> lock(guard, try_to_lock);
+		if (lock.owns_lock() && freshLatest){
+			target = latest;
+			freshLatest = false;
+			if (!started){
+				smoothed = target;
+				started = true;
+				return true;
+			}
+		}
+	}
+	if (!started)
+		return false;
+	float a = timeConstant > 0.f ? 1.f - exp(-dt / timeConstant) : 1.f;
+	bool moved = false;
+	//snap the last ten-thousandth of the way, so that it settles
+	auto ease = [&](float& value, float to){
+		if (value == to)
+			return;
+		value += (to - value) * a;
+		if (fabs(to - value) <= 1e-4f * max(fabs(to), 1.f))
+			value = to;
+		moved = true;
+	};
+	ease(smoothed.zmin, target.zmin);
+	ease(smoothed.zmax, target.zmax);
+	ease(smoothed.zlow, target.zlow);
+	ease(smoothed.zhigh, target.zhigh);
+	ease(smoothed.zpoint, target.zpoint);
+	ease(smoothed.coverage, target.coverage);
+	return moved;
+}
+
+void AutoFocus::reset(){
+	lock_guard<mutex> lock(guard);
+	hasPending = false;
+	freshLatest = false;
+	started = false;
+	generation++;
+}
+
+//the order statistics are taken in window depth and converted at the end only: the depth is
+//monotonic in z
+bool AutoFocus::measure(float* depth, unsigned int width, unsigned int height, Camera& camera,
+	float percentile, int px, int py, Stats& stats){
+	unsigned int count = width * height;
+	if (count == 0)
+		return false;
+	if (px < 0 || py < 0){
+		px = width / 2;
+		py = height / 2;
+	}
+	px = min(px, (int)width - 1);
+	py = min(py, (int)height - 1);
+	float dpoint = depth[(height - 1 - py) * width + px];
+
+	float* end = partition(depth, depth + count, [](float d){ return d < 1.f; });
+	size_t drawn = end - depth;
+	if (drawn == 0)
+		return false;
+	auto bounds = minmax_element(depth, end);
+	float dmin = *bounds.first, dmax = *bounds.second;
+	//ranks lo <= mid <= hi, each nth_element working inside the part the previous one left;
+	//lo rounds up to past the median at 50 with an even count, hence the clamp
+	size_t mid = (drawn - 1) / 2,
+		lo = min((size_t)(percentile / 100.f * (drawn - 1) + .5f), mid),
+		hi = drawn - 1 - lo;
+	nth_element(depth, depth + lo, end);
+	float dlow = depth[lo];
+	nth_element(depth + lo, depth + hi, end);
+	float dhigh = depth[hi];
+	if (!(dpoint < 1.f)){
+		nth_element(depth + lo, depth + mid, depth + hi + 1);
+		dpoint = depth[mid];
+	}
+
+	stats.zmin = DepthRange::windowToZ(camera, dmin);
+	stats.zmax = DepthRange::windowToZ(camera, dmax);
+	stats.zlow = DepthRange::windowToZ(camera, dlow);
+	stats.zhigh = DepthRange::windowToZ(camera, dhigh);
+	stats.zpoint = DepthRange::windowToZ(camera, dpoint);
+	stats.coverage = (float)drawn / count;
+	return true;
+}
+
+void AutoFocus::workerLoop(){
+	unique_lock<mutex> lock(guard);
+	for (;;){
+		wake.wait(lock, [this](){ return quit || hasPending; });
+		if (quit)
+			return;
+		swap(pending, working);
+		unsigned int width = pendingWidth, height = pendingHeight;
+		Camera camera = pendingCamera;
+		float p = percentile;
+		int x = pointX, y = pointY;
+		unsigned int job = generation;
+		hasPending = false;
+		lock.unlock();
+
+		Stats stats;
+		bool found = measure(working.data(), width, height, camera, p, x, y, stats);
+
+		lock.lock();
+		if (found && job == generation){
+			latest = stats;
+			freshLatest = true;
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Camera.h"
+
+/// Depth statistics of the frames shown, measured off the render loop for the automatic
+/// refocusing of the depth and focus modes.
+/// submit() hands over the depth buffer of a frame with the camera it was drawn with; a
+/// thread of its own reduces it, and update() picks up the latest statistics and eases
+/// the current ones toward them. The render loop never waits on that thread: it holds
+/// the lock only to swap buffers, and a buffer it has not started on yet is replaced by
+/// the next one submitted, so the statistics are those of the latest frame measured,
+/// one or two frames behind the view.
+class AutoFocus {
+public:
+	//depths as Camera::getZ of the frame measured
+	struct Stats {
+		float zmin, zmax;		//nearest and farthest surface drawn
+		float zlow, zhigh;		//percentile and 100 - percentile of the pixels drawn
+		float zpoint;			//surface under the chosen point, the median where it shows the background
+		float coverage;			//fraction of the pixels drawn
+	};
+
+	AutoFocus();
+	~AutoFocus();
+
+	//percentile of zlow and zhigh, 0..50: clips slivers of a few pixels off the range; 0 for zmin, zmax
+	void setPercentile(float p);
+	//point of zpoint in pixels, y going down as GLUT gives it; negative for the centre of the frame
+	void setPoint(int x, int y);
+	//seconds for the current statistics to cover 63% of a change, 0 to follow without easing
+	void setTimeConstant(float seconds);
+
+	//depth: window depths in 0..1 (glReadPixels of GL_DEPTH_COMPONENT, bottom row first), 1
+	//being the background; copied before return. The thread starts on the first call
+	void submit(const float* depth, unsigned int width, unsigned int height, const Camera& camera);
+	//move the current statistics toward the latest measured, by 1 - exp(-dt / timeConstant) of
+	//the way after dt seconds; the first ones are taken as they are. false while there are none
+	//yet, or when the current statistics are already there
+	bool update(float dt);
+	inline const Stats& current() const { return smoothed; }
+	//forget the statistics measured, after a cut or a change of mesh
+	void reset();
+
+	//the statistics of one depth buffer as the thread measures them, in linear time (nth_element);
+	//depth is reordered. false when nothing was drawn
+	static bool measure(float* depth, unsigned int width, unsigned int height, Camera& camera,
+		float percentile, int px, int py, Stats& stats);
+
+private:
+	std::thread worker;
+	std::mutex guard;
+	std::condition_variable wake;
+	bool quit = false;
+
+	//settings, copied by the thread with each buffer
+	float percentile = 2.f;
+	int pointX = -1, pointY = -1;
+	float timeConstant = 0.25f;
+
+	//the buffer waiting for the thread, and the one it works on
+	std::vector<float> pending, working;
+	unsigned int pendingWidth = 0, pendingHeight = 0;
+	Camera pendingCamera;
+	bool hasPending = false;
+
+	//written by the thread under guard
+	Stats latest;
+	bool freshLatest = false;
+	unsigned int generation = 0;	//bumped by reset(), a buffer of an older generation is dropped
+
+	Stats target, smoothed;
+	bool started = false;
+
+	void workerLoop();
+
+	AutoFocus(const AutoFocus&);
+	AutoFocus& operator=(const AutoFocus&);
+};
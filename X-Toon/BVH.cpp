@@ -0,0 +1,378 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+	const unsigned int BINS = 16;			//per axis, the split candidates lie between them
+	const unsigned int MEDIAN_DEPTH = 32;	//deeper nodes split in the middle, so the depth stays under STACK
+	const unsigned int STACK = 64;
+	const unsigned int GRAIN = 4096;
+
+	struct Box {
+		float lo[3], hi[3];
+		Box(){
+			for (int a = 0; a < 3; a++){
+				lo[a] = FLT_MAX;
+				hi[a] = -FLT_MAX;
+			}
+		}
+		inline void grow(const float* p){
+			for (int a = 0; a < 3; a++){
+				lo[a] = min(lo[a], p[a]);
+				hi[a] = max(hi[a], p[a]);
+			}
+		}
+		inline void grow(const Box& b){
+			for (int a = 0; a < 3; a++){
+				lo[a] = min(lo[a], b.lo[a]);
+				hi[a] = max(hi[a], b.hi[a]);
+			}
+		}
+		//half the surface area, 0 for an empty box
+		inline float area() const {
+			float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+			return dx < 0.f ? 0.f : dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	inline Box triangleBox(const Mesh& mesh, unsigned int t){
+		Box b;
+		for (int j = 0; j < 3; j++)
+			b.grow(&mesh.V[mesh.T[t].v[j]].p[0]);
+		return b;
+	}
+
+	inline void setBounds(BVH::Node& node, const Box& b){
+		for (int a = 0; a < 3; a++){
+			node.lo[a] = b.lo[a];
+			node.hi[a] = b.hi[a];
+		}
+	}
+
+	//a triangle and its box, moved along with the partitions so that they are read in order
+	struct Reference {
+		Box box;
+		unsigned int triangle;
+		inline float centroid(int a) const { return (box.lo[a] + box.hi[a]) * .5f; }
+	};
+
+	struct Builder {
+		vector<BVH::Node>& nodes;
+		vector<Reference>& references;
+
+		//append the subtree over references[begin, end)
+		void node(unsigned int begin, unsigned int end, unsigned int depth){
+			unsigned int index = (unsigned int)nodes.size();
+			nodes.push_back(BVH::Node());
+			Box bounds, centers;
+			for (unsigned int k = begin; k < end; k++){
+				const Reference& r = references[k];
+				bounds.grow(r.box);
+				float c[3] = { r.centroid(0), r.centroid(1), r.centroid(2) };
+				centers.grow(c);
+			}
+			setBounds(nodes[index], bounds);
+			unsigned int count = end - begin;
+			if (count <= BVH::MAX_LEAF){
+				nodes[index].first = begin;
+				nodes[index].count = count;
+				return;
+			}
+
+			//bins along the longest axis of the centroids, then the cheapest split between
+			//bins: areas * counts of both sides
+			int axis = 0;
+			for (int a = 1; a < 3; a++)
+				if (centers.hi[a] - centers.lo[a] > centers.hi[axis] - centers.lo[axis])
+					axis = a;
+			float lo = centers.lo[axis], extent = centers.hi[axis] - lo;
+			unsigned int split = 0;
+			if (depth < MEDIAN_DEPTH && extent > 0.f){
+				Box binBoxes[BINS];
+				unsigned int binCounts[BINS] = { 0 };
+				float scale = BINS / extent;
+				for (unsigned int k = begin; k < end; k++){
+					const Reference& r = references[k];
+					unsigned int b = min(BINS - 1, (unsigned int)((r.centroid(axis) - lo) * scale));
+					binBoxes[b].grow(r.box);
+					binCounts[b]++;
+				}
+				float rightCosts[BINS];
+				Box right;
+				unsigned int rightCount = 0;
+				for (unsigned int b = BINS - 1; b > 0; b--){
+					right.grow(binBoxes[b]);
+					rightCount += binCounts[b];
+					rightCosts[b] = right.area() * rightCount;
+				}
+				Box left;
+				unsigned int leftCount = 0;
+				float best = FLT_MAX;
+				for (unsigned int b = 0; b + 1 < BINS; b++){
+					left.grow(binBoxes[b]);
+					leftCount += binCounts[b];
+					float cost = left.area() * leftCount + rightCosts[b + 1];
+					if (leftCount > 0 && leftCount < count && cost < best){
+						best = cost;
+						split = b + 1;
+					}
+				}
+			}
+
+			unsigned int mid;
+			if (split > 0){
+				float scale = BINS / extent;
+				mid = (unsigned int)(partition(references.begin() + begin, references.begin() + end, [&](const Reference& r){
+					return min(BINS - 1, (unsigned int)((r.centroid(axis) - lo) * scale)) < split;
+				}) - references.begin());
+			}
+			else{
+				//coincident centroids, or too deep: halves
+				mid = begin + count / 2;
+				nth_element(references.begin() + begin, references.begin() + mid, references.begin() + end,
+					[&](const Reference& r, const Reference& q){ return r.centroid(axis) < q.centroid(axis); });
+			}
+			nodes[index].count = 0;
+			node(begin, mid, depth + 1);
+			nodes[index].first = (unsigned int)nodes.size();
+			node(mid, end, depth + 1);
+		}
+	};
+
+	//gluPerspective frustum of a camera, for boxes
+	struct Frustum {
+		const CameraState& s;
+		float n, f, sx, sy;
+
+		Frustum(Camera& camera) : s(camera.state()){
+			n = camera.getNearPlane();
+			f = camera.getFarPlane();
+			sy = (float)(1. / tan(camera.getFovAngle() * 3.14159265358979323846 / 360.));
+			sx = sy / camera.getAspectRatio();
+		}
+
+		//the box in eye space is bounded by the box of half-extents e around c; outside when
+		//even its closest corner is beyond one plane, inside when its farthest corner is not
+		enum Overlap { OUTSIDE, PARTIAL, INSIDE };
+		Overlap overlap(const BVH::Node& node) const {
+			Vec3f center((node.lo[0] + node.hi[0]) * .5f, (node.lo[1] + node.hi[1]) * .5f, (node.lo[2] + node.hi[2]) * .5f);
+			Vec3f half(node.hi[0] - center[0], node.hi[1] - center[1], node.hi[2] - center[2]);
+			Vec3f c = s.toEye(center), e;
+			for (int j = 0; j < 3; j++)
+				e[j] = fabs(s.m[0][j]) * half[0] + fabs(s.m[1][j]) * half[1] + fabs(s.m[2][j]) * half[2];
+			if (c[2] - e[2] > -n || c[2] + e[2] < -f
+				|| sx * (fabs(c[0]) - e[0]) + c[2] - e[2] > 0.f || sy * (fabs(c[1]) - e[1]) + c[2] - e[2] > 0.f)
+				return OUTSIDE;
+			if (c[2] + e[2] <= -n && c[2] - e[2] >= -f
+				&& sx * (fabs(c[0]) + e[0]) + c[2] + e[2] <= 0.f && sy * (fabs(c[1]) + e[1]) + c[2] + e[2] <= 0.f)
+				return INSIDE;
+			return PARTIAL;
+		}
+	};
+
+	//entry distance of the ray into the box, or FLT_MAX when it misses it before tmax
+	inline float enter(const BVH::Node& node, const Vec3f& origin, const Vec3f& inverse, float tmax){
+		float t0 = 0.f, t1 = tmax;
+		for (int a = 0; a < 3; a++){
+			float tNear = (node.lo[a] - origin[a]) * inverse[a], tFar = (node.hi[a] - origin[a]) * inverse[a];
+			if (tNear > tFar)
+				swap(tNear, tFar);
+			t0 = max(t0, tNear);
+			t1 = min(t1, tFar);
+		}
+		return t0 <= t1 ? t0 : FLT_MAX;
+	}
+}
+
+void BVH::build(const Mesh& mesh, ThreadPool* pool){
+	unsigned int numT = (unsigned int)mesh.T.size();
+	nodes.clear();
+	triangles.resize(numT);
+	if (numT == 0)
+		return;
+	vector<Reference> references(numT);
+	ThreadPool::RangeFunc fn = [&](unsigned int begin, unsigned int end){
+		for (unsigned int t = begin; t < end; t++){
+			references[t].box = triangleBox(mesh, t);
+			references[t].triangle = t;
+		}
+	};
+	forChunks(pool, numT, GRAIN, fn);
+	nodes.reserve(2 * numT / MAX_LEAF + 1);
+	Builder builder = { nodes, references };
+	builder.node(0, numT, 0);
+	for (unsigned int k = 0; k < numT; k++)
+		triangles[k] = references[k].triangle;
+}
+
+void BVH::refit(const Mesh& mesh, ThreadPool* pool){
+	//leaves first, then the inner nodes from the last: children come after their parent
+	ThreadPool::RangeFunc fn = [&](unsigned int begin, unsigned int end){
+		for (unsigned int i = begin; i < end; i++){
+			if (nodes[i].count == 0)
+				continue;
+			Box b;
+			for (unsigned int k = nodes[i].first; k < nodes[i].first + nodes[i].count; k++)
+				b.grow(triangleBox(mesh, triangles[k]));
+			setBounds(nodes[i], b);
+		}
+	};
+	forChunks(pool, size(), GRAIN, fn);
+	for (unsigned int i = size(); i-- > 0;){
+		Node& node = nodes[i];
+		if (node.count != 0)
+			continue;
+		const Node& left = nodes[i + 1];
+		const Node& right = nodes[node.first];
+		for (int a = 0; a < 3; a++){
+			node.lo[a] = min(left.lo[a], right.lo[a]);
+			node.hi[a] = max(left.hi[a], right.hi[a]);
+		}
+	}
+}
+
+bool BVH::pick(const Mesh& mesh, const Vec3f& origin, const Vec3f& dir, Hit& hit, bool twoSided) const {
+	if (nodes.empty())
+		return false;
+	Vec3f inverse(1.f / dir[0], 1.f / dir[1], 1.f / dir[2]);
+	hit.t = FLT_MAX;
+	bool found = false;
+	unsigned int stack[STACK], top = 0;
+	if (enter(nodes[0], origin, inverse, hit.t) != FLT_MAX)
+		stack[top++] = 0;
+	while (top > 0){
+		const Node& node = nodes[stack[--top]];
+		if (node.count == 0){
+			//nearer child on top; a popped node may be farther than a hit found since
+			unsigned int a = (unsigned int)(&node - &nodes[0]) + 1, b = node.first;
+			float ta = enter(nodes[a], origin, inverse, hit.t), tb = enter(nodes[b], origin, inverse, hit.t);
+			if (ta > tb){
+				swap(a, b);
+				swap(ta, tb);
+			}
+			if (tb != FLT_MAX)
+				stack[top++] = b;
+			if (ta != FLT_MAX)
+				stack[top++] = a;
+			continue;
+		}
+		if (enter(node, origin, inverse, hit.t) == FLT_MAX)
+			continue;
+		//Moller-Trumbore; det = -dot(dir, face normal) is positive for a front face
+		for (unsigned int k = node.first; k < node.first + node.count; k++){
+			const Triangle& tri = mesh.T[triangles[k]];
+			const Vec3f& p0 = mesh.V[tri.v[0]].p;
+			Vec3f e1 = mesh.V[tri.v[1]].p - p0, e2 = mesh.V[tri.v[2]].p - p0;
+			Vec3f pv = cross(dir, e2);
+			float det = dot(e1, pv);
+			if (det == 0.f || (det < 0.f && !twoSided))
+				continue;
+			float inv = 1.f / det;
+			Vec3f tv = origin - p0;
+			float u = dot(tv, pv) * inv;
+			if (u < 0.f || u > 1.f)
+				continue;
+			Vec3f qv = cross(tv, e1);
+			float v = dot(dir, qv) * inv;
+			if (v < 0.f || u + v > 1.f)
+				continue;
+			float t = dot(e2, qv) * inv;
+			if (t > 0.f && t < hit.t){
+				hit.triangle = triangles[k];
+				hit.t = t;
+				hit.u = u;
+				hit.v = v;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+bool BVH::pick(const Mesh& mesh, Camera& camera, int x, int y, Hit& hit, bool twoSided) const {
+	unsigned int w = camera.getScreenWidth(), h = camera.getScreenHeight();
+	if (w == 0 || h == 0)
+		return false;
+	float sy = (float)(1. / tan(camera.getFovAngle() * 3.14159265358979323846 / 360.));
+	float sx = sy / camera.getAspectRatio();
+	Vec3f eye((2.f * (x + .5f) / w - 1.f) / sx, (1.f - 2.f * (y + .5f) / h) / sy, -1.f);
+	const CameraState& s = camera.state();
+	return pick(mesh, s.pos, s.getV(eye), hit, twoSided);
+}
+
+void BVH::frustumQuery(Camera& camera, vector<unsigned int>& result) const {
+	result.clear();
+	if (nodes.empty())
+		return;
+	Frustum frustum(camera);
+	unsigned int stack[STACK], top = 0;
+	stack[top++] = 0;
+	while (top > 0){
+		unsigned int i = stack[--top];
+		const Node& node = nodes[i];
+		Frustum::Overlap overlap = frustum.overlap(node);
+		if (overlap == Frustum::OUTSIDE)
+			continue;
+		if (overlap == Frustum::INSIDE){
+			//the triangles of a subtree are contiguous, from its leftmost to its rightmost leaf
+			unsigned int left = i, right = i;
+			while (nodes[left].count == 0)
+				left++;
+			while (nodes[right].count == 0)
+				right = nodes[right].first;
+			result.insert(result.end(), triangles.begin() + nodes[left].first,
+				triangles.begin() + nodes[right].first + nodes[right].count);
+		}
+		else if (node.count == 0){
+			stack[top++] = node.first;
+			stack[top++] = i + 1;
+		}
+		else
+			result.insert(result.end(), triangles.begin() + node.first, triangles.begin() + node.first + node.count);
+	}
+}
+
+bool BVH::depthRange(const Mesh& mesh, Camera& camera, float& zmin, float& zmax, bool inFrustum) const {
+	zmin = FLT_MAX;
+	zmax = -FLT_MAX;
+	if (nodes.empty())
+		return false;
+	Frustum frustum(camera);
+	const CameraState& s = frustum.s;
+	unsigned int stack[STACK], top = 0;
+	stack[top++] = 0;
+	while (top > 0){
+		unsigned int i = stack[--top];
+		const Node& node = nodes[i];
+		//getZ = zoom - zdir . v is linear: its extremes over the box are at corners; widened
+		//by a few ulps so that rounding never skips the extreme vertex
+		float dotMax = 0.f, dotMin = 0.f;
+		for (int a = 0; a < 3; a++){
+			float l = s.zdir[a] * node.lo[a], h = s.zdir[a] * node.hi[a];
+			dotMax += max(l, h);
+			dotMin += min(l, h);
+		}
+		float boxMin = s.zoom - dotMax, boxMax = s.zoom - dotMin;
+		float slack = 1e-6f * (fabs(boxMin) + fabs(boxMax) + fabs(s.zoom));
+		if (boxMin - slack >= zmin && boxMax + slack <= zmax)
+			continue;
+		if (inFrustum && frustum.overlap(node) == Frustum::OUTSIDE)
+			continue;
+		if (node.count == 0){
+			stack[top++] = node.first;
+			stack[top++] = i + 1;
+			continue;
+		}
+		for (unsigned int k = node.first; k < node.first + node.count; k++)
+			for (int j = 0; j < 3; j++){
+				float z = s.getZ(mesh.V[mesh.T[triangles[k]].v[j]].p);
+				zmin = min(zmin, z);
+				zmax = max(zmax, z);
+			}
+	}
+	return zmin <= zmax;
+}
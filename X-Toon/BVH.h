@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Camera.h"
+
+class ThreadPool;
+
+/// Bounding volume hierarchy over the triangles of a mesh, for the queries that would
+/// otherwise walk every triangle: ray picking, view frustum overlap and view depth range.
+/// Built top-down with the surface area heuristic over binned triangle centroids and
+/// stored as a flat array of 32-byte nodes in depth-first order, the left child of a
+/// node right after it. refit() updates the boxes after the vertices moved, keeping the
+/// tree: the queries stay exact, only slower when the motion was large.
+class BVH {
+public:
+	static const unsigned int MAX_LEAF = 4;		//triangles per leaf
+
+	struct Node {
+		float lo[3];
+		unsigned int first;		//leaf: triangles[first ..]; inner node: index of the right child
+		float hi[3];
+		unsigned int count;		//triangles of a leaf, 0 for an inner node
+	};
+
+	struct Hit {
+		unsigned int triangle;
+		float t;		//distance along the ray, in units of its direction
+		float u, v;		//barycentric coordinates of the hit point on vertices 1 and 2
+	};
+
+	//build the tree over mesh.T, to call again whenever the triangles change
+	void build(const Mesh& mesh, ThreadPool* pool = nullptr);
+	//recompute the boxes from the current positions of mesh.V
+	void refit(const Mesh& mesh, ThreadPool* pool = nullptr);
+
+	inline unsigned int size() const { return (unsigned int)nodes.size(); }
+	inline const Node& operator[](unsigned int i) const { return nodes[i]; }
+	//triangles of the leaves, in leaf order
+	inline unsigned int triangle(unsigned int k) const { return triangles[k]; }
+
+	//nearest triangle hit by the ray origin + t * dir with t > 0, facing the ray unless
+	//twoSided (back faces are culled when drawing)
+	bool pick(const Mesh& mesh, const Vec3f& origin, const Vec3f& dir, Hit& hit, bool twoSided = false) const;
+	//same along the view ray through the pixel (x, y) of the window of camera, y going down
+	bool pick(const Mesh& mesh, Camera& camera, int x, int y, Hit& hit, bool twoSided = false) const;
+	//triangles whose box overlaps the view frustum of camera: a superset of the visible ones
+	void frustumQuery(Camera& camera, std::vector<unsigned int>& result) const;
+	//exact range of camera.getZ over the vertices of the triangles, or of the triangles of
+	//frustumQuery when inFrustum; false when there is none
+	bool depthRange(const Mesh& mesh, Camera& camera, float& zmin, float& zmax, bool inFrustum = false) const;
+
+private:
+	std::vector<Node> nodes;
+	std::vector<unsigned int> triangles;
+};
@@ -0,0 +1,536 @@
+// ----------------------------------------------
+// X-Toon NPR benchmarks
+// Standalone executable: build it from this file and every other .cpp of
+// the project except Main.cpp. No window nor OpenGL context is opened.
+//
+// Usage: ./benchmark [-o <results.json>] [-n <repetitions>] [-t <threads>] [-s <faces>] [-c] [<filter>]
+//   -s sets the size of the generated OFF file of the loading benchmark
+//   (default 1000000 triangles, 0 to skip it)
+//   -c runs the checks of the approximate X-Toon math and of the mesh cache
+//   instead of the benchmarks, and exits with 1 if one fails
+//   only the benchmarks whose name contains <filter> are run; the results
+//   (milliseconds per repetition: median, p95, p99, min, mean) are printed
+//   and written to <results.json> (default benchmark.json)
+// ----------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Vec3.h"
+#include "Camera.h"
+#include "Mesh.h"
+#include "MeshCache.h"
+#include "Meshlets.h"
+#include "BVH.h"
+#include "MeshLOD.h"
+#include "MeshStream.h"
+#include "DepthRange.h"
+#include "AutoFocus.h"
+#include "XToon.h"
+#include "ToonLUT.h"
+#include "SoftRaster.h"
+#include "ThreadPool.h"
+#include "EasyBMP/EasyBMP.h"
+
+using namespace std;
+
+static const char* MODELS[] = { "models/bunny.off", "models/mount.off" };
+static const char* TEXTURES[] = { "texture2D/ap1.bmp", "texture2D/ap2.bmp", "texture2D/ap3.bmp", "texture2D/ap4.bmp",
+	"texture2D/db1.bmp", "texture2D/db2.bmp", "texture2D/db3.bmp", "texture2D/fb1.bmp", "texture2D/fb2.bmp",
+	"texture2D/hl1.bmp", "texture2D/hl2.bmp", "texture2D/hl3.bmp",
+	"texture2D/ns1.bmp", "texture2D/ns2.bmp", "texture2D/ns3.bmp" };
+static const unsigned int FRAME_WIDTH = 1024, FRAME_HEIGHT = 768;
+
+struct Result {
+	string name;
+	unsigned int items;		//vertices, triangles, pixels... processed per repetition, 0 if not meaningful
+	vector<double> ms;		//sorted
+	double percentile(double p) const {
+		unsigned int i = (unsigned int)(p * (ms.size() - 1) + 0.5);
+		return ms[min(i, (unsigned int)ms.size() - 1)];
+	}
+	double mean() const {
+		double s = 0;
+		for (unsigned int i = 0; i < ms.size(); i++)
+			s += ms[i];
+		return s / ms.size();
+	}
+};
+
+static vector<Result> results;
+static unsigned int repetitions = 20;
+static string filter;
+
+static bool selected(const string& name){
+	return filter.empty() || name.find(filter) != string::npos;
+}
+
+//time fn repetitions times after one warm-up run; setup runs before each call, untimed
+static void bench(const string& name, unsigned int items, const function<void()>& fn,
+	const function<void()>& setup = function<void()>()){
+	if (!selected(name))
+		return;
+	Result r;
+	r.name = name;
+	r.items = items;
+	for (unsigned int i = 0; i <= repetitions; i++){
+		if (setup)
+			setup();
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		fn();
+		chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+		if (i > 0)
+			r.ms.push_back(chrono::duration<double, milli>(t1 - t0).count());
+	}
+	sort(r.ms.begin(), r.ms.end());
+	printf("%-44s median %9.3f ms  p95 %9.3f  p99 %9.3f\n", name.c_str(), r.percentile(0.5), r.percentile(0.95), r.percentile(0.99));
+	results.push_back(r);
+}
+
+//load a model for the benchmarks, reporting why it cannot be read
+static bool load(Mesh& mesh, const string& model){
+	string error;
+	if (mesh.loadOFF(model, &error))
+		return true;
+	cerr << "skipping " << model << ": " << error << endl;
+	return false;
+}
+
+static string baseName(const string& path){
+	size_t s = path.find_last_of("/\\"), d = path.find_last_of('.');
+	return path.substr(s + 1, d - s - 1);
+}
+
+static bool writeJSON(const string& filename, unsigned int threads){
+	ofstream out(filename.c_str());
+	if (!out)
+		return false;
+	out << "{\n  \"repetitions\": " << repetitions << ",\n  \"threads\": " << threads << ",\n  \"results\": [\n";
+	for (unsigned int i = 0; i < results.size(); i++){
+		const Result& r = results[i];
+		char line[512];
+		snprintf(line, sizeof(line), "    {\"name\": \"%s\", \"items\": %u, \"median_ms\": %.6f, \"p95_ms\": %.6f, "
+			"\"p99_ms\": %.6f, \"min_ms\": %.6f, \"mean_ms\": %.6f}%s\n",
+			r.name.c_str(), r.items, r.percentile(0.5), r.percentile(0.95), r.percentile(0.99), r.ms[0], r.mean(),
+			i + 1 < results.size() ? "," : "");
+		out << line;
+	}
+	out << "  ]\n}\n";
+	return (bool)out;
+}
+
+//mesh loading and processing
+static void benchMesh(const string& model, ThreadPool& pool){
+	string m = baseName(model);
+	Mesh mesh;
+	if (!load(mesh, model))
+		return;
+	bench("mesh/loadOFF/" + m, mesh.T.size(), [&](){ Mesh loaded; loaded.loadOFF(model); });
+	bench("mesh/loadOFF-pool/" + m, mesh.T.size(), [&](){ Mesh loaded; loaded.loadOFF(model, NULL, &pool); });
+	bench("mesh/load-cached/" + m, mesh.T.size(), [&](){ Mesh loaded; loaded.load(model, NULL, &pool); });
+	bench("mesh/convertCache/" + m, mesh.T.size(), [&](){ string error; MeshCache::convert("benchmark_tmp.xtc", model, error); });
+	remove("benchmark_tmp.xtc");
+	bench("mesh/recomputeNormals/" + m, mesh.T.size(), [&](){ mesh.recomputeNormals(); });
+	bench("mesh/recomputeNormals-pool/" + m, mesh.T.size(), [&](){ mesh.recomputeNormals(Mesh::UNIFORM, &pool); });
+	bench("mesh/recomputeNormals-area/" + m, mesh.T.size(), [&](){ mesh.recomputeNormals(Mesh::AREA, &pool); });
+	bench("mesh/recomputeNormals-angle/" + m, mesh.T.size(), [&](){ mesh.recomputeNormals(Mesh::ANGLE, &pool); });
+	bench("mesh/buildAdjacency/" + m, mesh.T.size(), [&](){ mesh.buildAdjacency(); });
+	Mesh optimized;
+	Mesh::LocalityStats stats;
+	bench("mesh/optimizeLocality/" + m, mesh.T.size(), [&](){ stats = optimized.optimizeLocality(); }, [&](){ optimized = mesh; });
+	if (selected("mesh/optimizeLocality/" + m))
+		printf("%-44s ACMR %.3f -> %.3f\n", m.c_str(), stats.acmrBefore, stats.acmrAfter);
+	Mesh reordered;
+	MeshLOD lod;
+	bench("mesh/buildLOD/" + m, mesh.T.size(), [&](){ lod.build(reordered, .25f, 4096, &pool); }, [&](){ reordered = mesh; });
+	if (selected("mesh/buildLOD/" + m))
+		for (unsigned int l = 1; l < lod.size(); l++)
+			printf("%-44s level %u: %u triangles, error %g\n", m.c_str(), l, (unsigned int)lod.triangles(reordered, l).size(), lod.levels[l - 1].error);
+	Meshlets meshlets;
+	bench("mesh/buildMeshlets/" + m, mesh.T.size(), [&](){ meshlets.build(mesh); });
+	BVH bvh;
+	bench("mesh/buildBVH/" + m, mesh.T.size(), [&](){ bvh.build(mesh); });
+	bench("mesh/buildBVH-pool/" + m, mesh.T.size(), [&](){ bvh.build(mesh, &pool); });
+	bench("mesh/refitBVH/" + m, mesh.T.size(), [&](){ bvh.refit(mesh, &pool); });
+	bench("mesh/centerAndScaleToUnit/" + m, mesh.V.size(), [&](){ mesh.centerAndScaleToUnit(); });
+}
+
+//loading of a generated grid of about numFaces triangles
+static void benchSyntheticOFF(unsigned int numFaces, ThreadPool& pool){
+	if (numFaces == 0 || !(selected("mesh/loadOFF/synthetic") || selected("mesh/loadOFF-pool/synthetic")
+		|| selected("mesh/load-cached/synthetic")))
+		return;
+	unsigned int k = max(1u, (unsigned int)sqrt(numFaces / 2.));
+	const char* filename = "benchmark_synthetic.off";
+	FILE* out = fopen(filename, "w");
+	if (out == NULL){
+		cerr << "could not write " << filename << endl;
+		return;
+	}
+	fprintf(out, "OFF\n%u %u 0\n", (k + 1) * (k + 1), 2 * k * k);
+	for (unsigned int y = 0; y <= k; y++)
+		for (unsigned int x = 0; x <= k; x++)
+			fprintf(out, "%f %f %f\n", (float)x / k, (float)y / k, 0.1f * sin(x * 0.1f) * cos(y * 0.1f));
+	for (unsigned int y = 0; y < k; y++)
+		for (unsigned int x = 0; x < k; x++){
+			unsigned int i = y * (k + 1) + x;
+			fprintf(out, "3 %u %u %u\n3 %u %u %u\n", i, i + 1, i + k + 2, i, i + k + 2, i + k + 1);
+		}
+	fclose(out);
+	bench("mesh/loadOFF/synthetic", 2 * k * k, [&](){ Mesh loaded; loaded.loadOFF(filename); });
+	bench("mesh/loadOFF-pool/synthetic", 2 * k * k, [&](){ Mesh loaded; loaded.loadOFF(filename, NULL, &pool); });
+	bench("mesh/load-cached/synthetic", 2 * k * k, [&](){ Mesh loaded; loaded.load(filename, NULL, &pool); });
+	remove(filename);
+	remove(MeshCache::filenameFor(filename).c_str());
+}
+
+//the four CPU modes over all vertices, on one thread and on the pool
+static void benchShading(const string& model, ThreadPool& pool){
+	string m = baseName(model);
+	Mesh mesh;
+	if (!load(mesh, model))
+		return;
+	VertexArrays va;
+	va.build(mesh.V);
+	vector<float> rgb(3 * va.size());
+	Camera camera(1, 100);
+	camera.setSize(FRAME_WIDTH, FRAME_HEIGHT);
+	float zmind = 2.2f, zmaxd = 3.8f, zfoc = 3.f, zmin = .1f, zmax = .6f, r = 2.f, s = 1.f;
+	const char* modes[] = { "depth", "focus", "silhouette", "highlight" };
+	for (int k = 0; k < 4; k++){
+		XToon xtoon("texture2D/db2.bmp", Vec3f(10, 10, 10), &camera);
+		if (k == 0) xtoon.setForDepth(&zmind, &zmaxd, false);
+		if (k == 1) xtoon.setForFocus(&zfoc, &zmin, &zmax, false);
+		if (k == 2) xtoon.setForSilhouette(&r, false);
+		if (k == 3) xtoon.setForHighlight(&s, false);
+		string name = string("xtoon/") + modes[k] + "/" + m;
+		bench(name + "/vertex", va.size(), [&](){
+			for (unsigned int i = 0; i < mesh.V.size(); i++){
+				const Vertex& v = mesh.V[i];
+				float d = k == 0 ? xtoon.getForDepth(v.p) : k == 1 ? xtoon.getForFocus(v.p) :
+					k == 2 ? xtoon.getForSilhouette(v.p, v.n) : xtoon.getForHighlight(v.p, v.n);
+				Vec3f c = xtoon.get(v.p, v.n, d);
+				rgb[3 * i] = c[0];
+			}
+		});
+		bench(name + "/batch", va.size(), [&](){
+			xtoon.getBatch(va.size(), &va.px[0], &va.py[0], &va.pz[0], &va.nx[0], &va.ny[0], &va.nz[0], &rgb[0]);
+		});
+		bench(name + "/pool", va.size(), [&](){
+			xtoon.getBatch(va.size(), &va.px[0], &va.py[0], &va.pz[0], &va.nx[0], &va.ny[0], &va.nz[0], &rgb[0], &pool);
+		});
+		xtoon.approxMath(true);
+		bench(name + "/batch-approx", va.size(), [&](){
+			xtoon.getBatch(va.size(), &va.px[0], &va.py[0], &va.pz[0], &va.nx[0], &va.ny[0], &va.nz[0], &rgb[0]);
+		});
+	}
+}
+
+//texture set read and write
+static void benchBMP(){
+	for (unsigned int i = 0; i < sizeof(TEXTURES) / sizeof(TEXTURES[0]); i++){
+		string t = baseName(TEXTURES[i]);
+		BMP image;
+		bench("bmp/read/" + t, 256 * 256, [&](){ image.ReadFromFile(TEXTURES[i]); });
+		bench("bmp/write/" + t, 256 * 256, [&](){ image.WriteToFile("benchmark_tmp.bmp"); });
+	}
+	remove("benchmark_tmp.bmp");
+}
+
+//full headless frame: projection, binning, rasterization, shading and BMP output
+static void benchFrame(const string& model, ThreadPool& pool){
+	string m = baseName(model);
+	Mesh mesh;
+	if (!load(mesh, model))
+		return;
+	Camera camera(1, 100);
+	camera.setSize(FRAME_WIDTH, FRAME_HEIGHT);
+	float r = 2.f;
+	XToon xtoon("texture2D/ns3.bmp", Vec3f(10, 10, 10), &camera);
+	xtoon.setForSilhouette(&r, false);
+	SoftRaster raster;
+	raster.resize(FRAME_WIDTH, FRAME_HEIGHT);
+	raster.setClearColor(Vec3f(.8f, .8f, .8f));
+	unsigned int pixels = FRAME_WIDTH * FRAME_HEIGHT;
+	bench("frame/render/" + m, pixels, [&](){ raster.render(mesh, camera, xtoon); });
+	bench("frame/render-pool/" + m, pixels, [&](){ raster.render(mesh, camera, xtoon, &pool); });
+	Mesh optimized = mesh;
+	optimized.optimizeLocality();
+	bench("frame/render-optimized/" + m, pixels, [&](){ raster.render(optimized, camera, xtoon); });
+	Meshlets meshlets;
+	meshlets.build(optimized);
+	bench("frame/render-meshlets/" + m, pixels, [&](){ raster.render(optimized, camera, xtoon, nullptr, &meshlets); });
+	MeshStream stream;
+	if (stream.open(model))
+		bench("frame/render-stream/" + m, pixels, [&](){ raster.render(stream, camera, xtoon, &pool); });
+	bench("frame/writeBMP/" + m, pixels, [&](){ raster.writeBMP("benchmark_tmp.bmp"); });
+	remove("benchmark_tmp.bmp");
+}
+
+//spatial queries of the refocus key and of picking, per view
+static void benchQueries(const string& model, ThreadPool& pool){
+	string m = baseName(model);
+	Mesh mesh;
+	if (!load(mesh, model))
+		return;
+	Camera camera(1, 100);
+	camera.setSize(FRAME_WIDTH, FRAME_HEIGHT);
+	BVH bvh;
+	bvh.build(mesh);
+	float zmin, zmax;
+	bench("query/depthRange-scan/" + m, mesh.T.size(), [&](){
+		zmin = 100.f;
+		zmax = 1.f;
+		for (unsigned int i = 0; i < mesh.T.size(); i++)
+			for (unsigned int j = 0; j < 3; j++){
+				float z = camera.getZ(mesh.V[mesh.T[i].v[j]].p);
+				zmin = min(zmin, z);
+				zmax = max(zmax, z);
+			}
+	});
+	bench("query/depthRange-bvh/" + m, mesh.T.size(), [&](){ bvh.depthRange(mesh, camera, zmin, zmax); });
+	VertexArrays vertices;
+	vertices.build(mesh.V);
+	bench("query/depthRange-exact/" + m, mesh.V.size(), [&](){ DepthRange::exact(vertices, camera, zmin, zmax); });
+	bench("query/depthRange-exact-pool/" + m, mesh.V.size(), [&](){ DepthRange::exact(vertices, camera, zmin, zmax, &pool); });
+	bench("query/depthRange-bound/" + m, 1, [&](){ DepthRange::bound(mesh, camera, zmin, zmax); });
+	//the depth buffer of a software frame, in glReadPixels order
+	vector<float> depth(FRAME_WIDTH * FRAME_HEIGHT, 1.f);
+	if (selected("query/depthRange-visible/" + m) || selected("query/autoFocus-measure/" + m)){
+		float r = 2.f;
+		XToon xtoon("texture2D/ns3.bmp", Vec3f(10, 10, 10), &camera);
+		xtoon.setForSilhouette(&r, false);
+		SoftRaster raster;
+		raster.resize(FRAME_WIDTH, FRAME_HEIGHT);
+		raster.render(mesh, camera, xtoon);
+		for (unsigned int y = 0; y < FRAME_HEIGHT; y++)
+			for (unsigned int x = 0; x < FRAME_WIDTH; x++)
+				depth[y * FRAME_WIDTH + x] = raster.depth(x, y);
+	}
+	bench("query/depthRange-visible/" + m, FRAME_WIDTH * FRAME_HEIGHT, [&](){
+		DepthRange::visible(&depth[0], depth.size(), camera, zmin, zmax, &pool);
+	});
+	//with the copy that AutoFocus::submit makes, measure() reordering its buffer
+	vector<float> working;
+	bench("query/autoFocus-measure/" + m, FRAME_WIDTH * FRAME_HEIGHT, [&](){
+		AutoFocus::Stats stats;
+		working = depth;
+		AutoFocus::measure(&working[0], FRAME_WIDTH, FRAME_HEIGHT, camera, 2.f, -1, -1, stats);
+	});
+	vector<unsigned int> inside;
+	bench("query/frustum-bvh/" + m, mesh.T.size(), [&](){ bvh.frustumQuery(camera, inside); });
+	//a 32 x 24 grid of pixels
+	bench("query/pick-bvh/" + m, 32 * 24, [&](){
+		BVH::Hit hit;
+		for (unsigned int y = 0; y < 24; y++)
+			for (unsigned int x = 0; x < 32; x++)
+				bvh.pick(mesh, camera, x * FRAME_WIDTH / 32, y * FRAME_HEIGHT / 24, hit);
+	});
+}
+
+//one setting of a mode for checkApprox
+struct ApproxCase {
+	int mode;		//0 depth, 1 focus, 2 silhouette, 3 highlight
+	float a, b, c;	//zmin, zmax | zfocal, zmin, zmax | r | s
+};
+
+//approximate against exact math of the four CPU modes, over every vertex of model and a grid
+//of parameters, through a texture whose red channel is the row: the approximate row may only
+//be one off the exact one, where the exact detail value lies within half a row of the boundary
+//between them (XToon::approxMath); and the scalar getters must give the colours of getBatch,
+//approximate or not. Returns the number of failures
+static unsigned int checkApprox(const string& model, ThreadPool& pool){
+	string m = baseName(model);
+	Mesh mesh;
+	if (!load(mesh, model))
+		return 1;
+	VertexArrays va;
+	va.build(mesh.V);
+	unsigned int n = va.size();
+	Camera camera(1, 100);
+	camera.setSize(FRAME_WIDTH, FRAME_HEIGHT);
+
+	const char* texture = "benchmark_rows.bmp";
+	BMP rows;
+	rows.SetSize(ToonLUT::SIZE, ToonLUT::SIZE);
+	for (int y = 0; y < ToonLUT::SIZE; y++)
+		for (int x = 0; x < ToonLUT::SIZE; x++){
+			rows(x, y)->Red = (ebmpBYTE)y;
+			rows(x, y)->Green = (ebmpBYTE)x;
+			rows(x, y)->Blue = 0;
+		}
+	rows.WriteToFile(texture);
+	XToon xtoon(texture, Vec3f(10, 10, 10), &camera);
+	remove(texture);
+
+	vector<ApproxCase> cases;
+	const float depths[][2] = { { .5f, 10.f }, { 1.f, 100.f }, { .1f, 4.f }, { 2.2f, 3.8f }, { 2.9f, 3.1f }, { 2.99f, 3.01f } };
+	for (unsigned int i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+		cases.push_back({ 0, depths[i][0], depths[i][1], 0.f });
+	const float focals[] = { 2.5f, 3.f, 3.5f }, inner[] = { .02f, .1f, .3f }, ratios[] = { 1.5f, 3.f, 8.f };
+	for (float f : focals)
+		for (float zmin : inner)
+			for (float ratio : ratios)
+				if (zmin * ratio < f)
+					cases.push_back({ 1, f, zmin, zmin * ratio });
+	const float exponents[] = { 0.f, .25f, .5f, 1.f, 2.f, 4.f, 16.f, 64.f, 256.f, 1000.f };
+	for (int mode = 2; mode < 4; mode++)
+		for (float e : exponents)
+			cases.push_back({ mode, e, 0.f, 0.f });
+
+	const char* modes[] = { "depth", "focus", "silhouette", "highlight" };
+	unsigned int failures = 0;
+	unsigned int runs[4] = {}, boundary[4] = {}, off[4] = {}, mismatch[4] = {};
+	vector<float> exact(n), rgb(3 * n), rgbPool(3 * n);
+	vector<int> exactRows(n);
+	for (const ApproxCase& t : cases){
+		float a = t.a, b = t.b, c = t.c;
+		if (t.mode == 0) xtoon.setForDepth(&a, &b, false);
+		if (t.mode == 1) xtoon.setForFocus(&a, &b, &c, false);
+		if (t.mode == 2) xtoon.setForSilhouette(&a, false);
+		if (t.mode == 3) xtoon.setForHighlight(&a, false);
+		runs[t.mode]++;
+		for (int approx = 0; approx < 2; approx++){
+			xtoon.approxMath(approx == 1);
+			xtoon.getBatch(n, &va.px[0], &va.py[0], &va.pz[0], &va.nx[0], &va.ny[0], &va.nz[0], &rgb[0]);
+			xtoon.getBatch(n, &va.px[0], &va.py[0], &va.pz[0], &va.nx[0], &va.ny[0], &va.nz[0], &rgbPool[0], &pool);
+			for (unsigned int i = 0; i < n; i++){
+				const Vertex& v = mesh.V[i];
+				float d = t.mode == 0 ? xtoon.getForDepth(v.p) : t.mode == 1 ? xtoon.getForFocus(v.p) :
+					t.mode == 2 ? xtoon.getForSilhouette(v.p, v.n) : xtoon.getForHighlight(v.p, v.n);
+				Vec3f scalar = xtoon.get(v.p, v.n, d);
+				if (scalar[0] != rgb[3 * i] || scalar[1] != rgb[3 * i + 1] || scalar[2] != rgb[3 * i + 2]
+					|| rgbPool[3 * i] != rgb[3 * i] || rgbPool[3 * i + 1] != rgb[3 * i + 1] || rgbPool[3 * i + 2] != rgb[3 * i + 2])
+					mismatch[t.mode]++;
+				int row = (int)(rgb[3 * i] * 255.f + .5f);
+				if (approx == 0){
+					exact[i] = d;
+					exactRows[i] = row;
+					continue;
+				}
+				if (row == exactRows[i])
+					continue;
+				//the boundary crossed, between the two rows, and how far the exact value is from it
+				float edge = (float)max(row, exactRows[i]) / ToonLUT::SIZE;
+				if (abs(row - exactRows[i]) == 1 && fabs(exact[i] - edge) <= .5f / ToonLUT::SIZE)
+					boundary[t.mode]++;
+				else
+					off[t.mode]++;
+			}
+		}
+	}
+	for (int k = 0; k < 4; k++){
+		printf("%-44s %3u settings  %u vertices  rows one off at a boundary %u  off %u  scalar/batch mismatches %u\n",
+			("check/approx/" + string(modes[k]) + "/" + m).c_str(), runs[k], n, boundary[k], off[k], mismatch[k]);
+		failures += off[k] + mismatch[k];
+	}
+	return failures;
+}
+
+//bytes differing between two files, a longer one differing by its extra bytes
+static uint64_t differingBytes(const char* a, const char* b){
+	ifstream fa(a, ios::binary), fb(b, ios::binary);
+	vector<char> da((istreambuf_iterator<char>(fa)), istreambuf_iterator<char>()),
+		db((istreambuf_iterator<char>(fb)), istreambuf_iterator<char>());
+	uint64_t n = max(da.size(), db.size()) - min(da.size(), db.size());
+	for (size_t i = 0; i < min(da.size(), db.size()); i++)
+		n += da[i] != db[i];
+	return n;
+}
+
+//MeshCache::convert against MeshCache::write after Mesh::loadOFF, serial and on the pool:
+//the two caches must be the same file. Returns the number of failures
+static unsigned int checkCache(const string& model, ThreadPool& pool){
+	string m = baseName(model);
+	const char* converted = "benchmark_convert.xtc";
+	const char* written = "benchmark_write.xtc";
+	string error;
+	unsigned int failures = 0;
+	if (!MeshCache::convert(converted, model, error)){
+		cerr << error << endl;
+		return 1;
+	}
+	for (int threaded = 0; threaded < 2; threaded++){
+		Mesh mesh;
+		if (!mesh.loadOFF(model, &error, threaded ? &pool : nullptr) || !MeshCache::write(written, model, mesh, 0, error)){
+			cerr << error << endl;
+			failures++;
+			continue;
+		}
+		uint64_t n = differingBytes(converted, written);
+		printf("%-44s %llu bytes differ\n", ("check/cache-convert/" + m + (threaded ? "/pool" : "/serial")).c_str(),
+			(unsigned long long)n);
+		failures += n != 0;
+		remove(written);
+	}
+	remove(converted);
+	return failures;
+}
+
+int main(int argc, char** argv){
+	string output = "benchmark.json";
+	unsigned int threads = 0, syntheticFaces = 1000000;
+	bool check = false;
+	for (int i = 1; i < argc; i++){
+		string a = argv[i];
+		if (a == "-o" && i + 1 < argc)
+			output = argv[++i];
+		else if (a == "-n" && i + 1 < argc)
+			repetitions = max(1, atoi(argv[++i]));
+		else if (a == "-t" && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (a == "-s" && i + 1 < argc)
+			syntheticFaces = atoi(argv[++i]);
+		else if (a == "-c")
+			check = true;
+		else if (a[0] != '-')
+			filter = a;
+		else {
+			cerr << "Usage: ./benchmark [-o <results.json>] [-n <repetitions>] [-t <threads>] [-s <faces>] [-c] [<filter>]" << endl;
+			return 1;
+		}
+	}
+	SetEasyBMPwarningsOff();
+	ThreadPool pool(threads);
+
+	if (check){
+		unsigned int failures = 0;
+		for (unsigned int i = 0; i < 2; i++)
+			failures += checkApprox(MODELS[i], pool);
+		for (unsigned int i = 0; i < 2; i++)
+			failures += checkCache(MODELS[i], pool);
+		cout << (failures == 0 ? "all checks passed" : to_string(failures) + " failures") << endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	for (unsigned int i = 0; i < 2; i++)
+		benchMesh(MODELS[i], pool);
+	benchSyntheticOFF(syntheticFaces, pool);
+	for (unsigned int i = 0; i < 2; i++)
+		benchShading(MODELS[i], pool);
+	benchBMP();
+	for (unsigned int i = 0; i < 2; i++)
+		benchFrame(MODELS[i], pool);
+	for (unsigned int i = 0; i < 2; i++)
+		benchQueries(MODELS[i], pool);
+
+	if (results.empty()){
+		cerr << "no benchmark matches " << filter << endl;
+		return 1;
+	}
+	if (!writeJSON(output, pool.size())){
+		cerr << "could not write " << output << endl;
+		return 1;
+	}
+	cout << results.size() << " results written to " << output << endl;
+	return 0;
+}
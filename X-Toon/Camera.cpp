@@ -29,6 +29,7 @@
 //                                                                          
 // --------------------------------------------------------------------------
 
+#include "FPContract.h"
 #include "Camera.h"
 #include <GL/glut.h>
 #include <GL/glu.h>
@@ -125,6 +126,9 @@ Camera::Camera () {
   lastX = 0;
   lastY = 0;
   lastZoom = 0;
+
+  _state.stamp = 0;
+  dirty = true;
 }
 
 Camera::Camera(float np,float fp) {
@@ -148,20 +152,27 @@ Camera::Camera(float np,float fp) {
 	lastX = 0;
 	lastY = 0;
 	lastZoom = 0;
+
+	_state.stamp = 0;
+	dirty = true;
 }
 
 
 void Camera::resize (int _W, int _H) {
-  H = _H;
-  W = _W;
+  setSize (_W, _H);
   glViewport (0, 0, (GLint)W, (GLint)H);
   glMatrixMode (GL_PROJECTION);
   glLoadIdentity ();
-  aspectRatio = static_cast<float>(W)/static_cast<float>(H);
   gluPerspective (fovAngle, aspectRatio, nearPlane, farPlane);
   glMatrixMode (GL_MODELVIEW);
 }
 
+void Camera::setSize (int _W, int _H) {
+  H = _H;
+  W = _W;
+  aspectRatio = static_cast<float>(W)/static_cast<float>(H);
+}
+
 
 void Camera::initPos () {
   if (!ini) {
@@ -191,6 +202,7 @@ void Camera::initPos () {
     y = _y;
     z = _z;;
     _zoom = __zoom;
+    dirty = true;
   } 
 }
 
@@ -199,6 +211,7 @@ void Camera::move (float dx, float dy, float dz) {
   x += dx;
   y += dy;
   z += dz;
+  dirty = true;
 }
 
 
@@ -221,6 +234,7 @@ void Camera::rotate (int u, int v) {
     beginv = v;
     spinning = 1;
     add_quats (lastquat, curquat, curquat);
+    dirty = true;
   }
 }
 
@@ -239,44 +253,50 @@ void Camera::refreshZoom(int x,int y){
 		_zoom = nearPlane;
 		//cout << x << " " << y<<endl;
 	}
-		
+	dirty = true;
 }
 
 void Camera::apply () {
+  const CameraState & s = state ();
   glLoadIdentity();
   glTranslatef (x, y, z);
-  GLfloat m[4][4]; 
-  build_rotmatrix(m, curquat);
   glTranslatef (0.0, 0.0, -_zoom);
-  glMultMatrixf(&m[0][0]);
+  glMultMatrixf(&s.m[0][0]);
   //drawIndication();
 }
 
+const CameraState & Camera::state () {
+  if (dirty) {
+    build_rotmatrix(_state.m, curquat);
+    const float (&m)[4][4] = _state.m;
+    float _x = -x;
+    float _y = -y;
+    float _z = -z + _zoom;
+    _state.pos = Vec3f (m[0][0] * _x +  m[0][1] * _y +  m[0][2] * _z,
+                        m[1][0] * _x +  m[1][1] * _y +  m[1][2] * _z,
+                        m[2][0] * _x +  m[2][1] * _y +  m[2][2] * _z);
+    _state.zdir = Vec3f (m[0][2], m[1][2], m[2][2]);
+    _state.trans = Vec3f (x, y, z - _zoom);
+    _state.zoom = _zoom;
+    _state.stamp++;
+    dirty = false;
+  }
+  return _state;
+}
 
 void Camera::getPos (float & X, float & Y, float & Z) {
-  GLfloat m[4][4]; 
-  build_rotmatrix(m, curquat);
-  float _x = -x;
-  float _y = -y;
-  float _z = -z + _zoom;
-  X = m[0][0] * _x +  m[0][1] * _y +  m[0][2] * _z;
-  Y = m[1][0] * _x +  m[1][1] * _y +  m[1][2] * _z;
-  Z = m[2][0] * _x +  m[2][1] * _y +  m[2][2] * _z;
+  const CameraState & s = state ();
+  X = s.pos[0];
+  Y = s.pos[1];
+  Z = s.pos[2];
 }
 
 float Camera::getZ(const Vec3f& v){
-	GLfloat m[4][4];
-	build_rotmatrix(m, curquat);
-	return _zoom - m[0][2] * v[0] - m[1][2] * v[1] - m[2][2] * v[2];
+	return state().getZ(v);
 }
 
 Vec3f Camera::getV(const Vec3f& v){
-	GLfloat m[4][4];
-	build_rotmatrix(m, curquat);
-	return Vec3f(
-		m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
-		m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
-		m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+	return state().getV(v);
 }
 
 float Camera::getZ(){
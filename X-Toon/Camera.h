@@ -29,6 +29,32 @@
 #pragma once
 #include "Vec3.h"
 
+/// Snapshot of the camera transform, rebuilt only when the camera changed.
+/// Readers get it through Camera::state () and never modify it.
+struct CameraState {
+  float m[4][4];      // rotation matrix built from the trackball quaternion
+  Vec3f pos;          // eye position in model space
+  Vec3f zdir;         // view-direction row : getZ (v) = zoom - zdir . v
+  Vec3f trans;        // translation applied after the rotation : (x, y, z - zoom)
+  float zoom;
+  unsigned int stamp; // incremented on every rebuild
+
+  inline float getZ (const Vec3f & v) const {
+    return zoom - zdir[0] * v[0] - zdir[1] * v[1] - zdir[2] * v[2];
+  }
+  /// Model space to eye space, the modelview transform set by Camera::apply ().
+  inline Vec3f toEye (const Vec3f & v) const {
+    return Vec3f (m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2] + trans[0],
+                  m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2] + trans[1],
+                  m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2] + trans[2]);
+  }
+  inline Vec3f getV (const Vec3f & v) const {
+    return Vec3f (m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                  m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                  m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+  }
+};
+
 class Camera {
 public:
   Camera ();
@@ -46,6 +72,8 @@ public:
   inline unsigned int getScreenHeight () const { return H; }
   
   void resize (int W, int H);
+  /// Same as resize () without the OpenGL calls, for offscreen rendering.
+  void setSize (int W, int H);
   
   void initPos ();
 
@@ -57,6 +85,9 @@ public:
   void refreshZoom(int x, int y);
   void apply ();
   
+  // per-frame snapshot, rebuilt lazily after any move/rotate/zoom
+  const CameraState & state ();
+
   void getPos (float & x, float & y, float & z);
   inline void getPos (Vec3f & p) { getPos (p[0], p[1], p[2]); }
   float getZ(const Vec3f& v);
@@ -88,6 +119,9 @@ private:
   bool mouseZoomPressed;
   int lastX, lastY;
   float lastZoom;
+
+  CameraState _state;
+  bool dirty;
 };
 
 // Some Emacs-Hints -- please don't remove:
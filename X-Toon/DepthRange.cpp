@@ -0,0 +1,166 @@
+#include "FPContract.h"
+#include "DepthRange.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "SIMD.h"
+#include "SoftRaster.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+	const unsigned int GRAIN = 1 << 16;		//vertices or pixels per chunk of the parallel loops
+	const float INF = numeric_limits<float>::infinity();
+
+	//fn(begin, end, zmin, zmax) on the chunks of [0, count), on the pool when there is one,
+	//and the union of their ranges
+	template <class Func>
+	void reduce(ThreadPool* pool, unsigned int count, float& zmin, float& zmax, const Func& fn){
+		unsigned int numChunks = (count + GRAIN - 1) / GRAIN;
+		vector<float> lo(numChunks, INF), hi(numChunks, -INF);
+		auto chunks = [&](unsigned int begin, unsigned int end){
+			for (unsigned int c = begin; c < end; c++)
+				fn(c * GRAIN, min((c + 1) * GRAIN, count), lo[c], hi[c]);
+		};
+		forChunks(pool, numChunks, 1, chunks);
+		zmin = INF;
+		zmax = -INF;
+		for (unsigned int c = 0; c < numChunks; c++){
+			zmin = min(zmin, lo[c]);
+			zmax = max(zmax, hi[c]);
+		}
+	}
+
+	inline float lanesMin(vfloat v){
+		float lanes[vfloat::width];
+		v.store(lanes);
+		return *min_element(lanes, lanes + vfloat::width);
+	}
+	inline float lanesMax(vfloat v){
+		float lanes[vfloat::width];
+		v.store(lanes);
+		return *max_element(lanes, lanes + vfloat::width);
+	}
+
+}
+
+//inverts the gluPerspective depth
+float DepthRange::windowToZ(Camera& camera, float d){
+	const CameraState& s = camera.state();
+	double n = camera.getNearPlane(), f = camera.getFarPlane();
+	double w = 2. * f * n / ((f + n) - (2. * d - 1.) * (f - n));	//eye distance along the view axis
+	return (float)(w + s.trans[2] + s.zoom);
+}
+
+const char* DepthRange::name(Strategy strategy){
+	switch (strategy){
+	case EXACT: return "exact";
+	case BOUND: return "bounding sphere";
+	default: return "visible";
+	}
+}
+
+bool DepthRange::exact(const VertexArrays& vertices, Camera& camera, float& zmin, float& zmax, ThreadPool* pool){
+	unsigned int count = vertices.size();
+	if (count == 0)
+		return false;
+	const CameraState& s = camera.state();
+	const float* px = &vertices.px[0];
+	const float* py = &vertices.py[0];
+	const float* pz = &vertices.pz[0];
+	reduce(pool, count, zmin, zmax, [&](unsigned int begin, unsigned int end, float& lo, float& hi){
+		//zoom - zdir . p in the operation order of CameraState::getZ
+		vfloat zoom(s.zoom), dx(s.zdir[0]), dy(s.zdir[1]), dz(s.zdir[2]);
+		vfloat vlo(INF), vhi(-INF);
+		unsigned int i = begin;
+		for (; i + vfloat::width <= end; i += vfloat::width){
+			vfloat z = zoom - dx * vfloat::load(px + i) - dy * vfloat::load(py + i) - dz * vfloat::load(pz + i);
+			vlo = vmin(vlo, z);
+			vhi = vmax(vhi, z);
+		}
+		lo = lanesMin(vlo);
+		hi = lanesMax(vhi);
+		for (; i < end; i++){
+			float z = s.getZ(Vec3f(px[i], py[i], pz[i]));
+			lo = min(lo, z);
+			hi = max(hi, z);
+		}
+	});
+	return true;
+}
+
+bool DepthRange::referenced(const Mesh& mesh, VertexArrays& vertices){
+	vector<unsigned char> used(mesh.V.size(), 0);
+	for (unsigned int t = 0; t < mesh.T.size(); t++)
+		for (unsigned int j = 0; j < 3; j++)
+			used[mesh.T[t].v[j]] = 1;
+	unsigned int count = (unsigned int)std::count(used.begin(), used.end(), 1);
+	if (count == mesh.V.size()){
+		vertices.resize(0);
+		return false;
+	}
+	vertices.resize(count);
+	unsigned int k = 0;
+	for (unsigned int i = 0; i < mesh.V.size(); i++)
+		if (used[i]){
+			const Vertex& v = mesh.V[i];
+			vertices.px[k] = v.p[0]; vertices.py[k] = v.p[1]; vertices.pz[k] = v.p[2];
+			vertices.nx[k] = v.n[0]; vertices.ny[k] = v.n[1]; vertices.nz[k] = v.n[2];
+			k++;
+		}
+	return true;
+}
+
+bool DepthRange::bound(const Mesh& mesh, Camera& camera, float& zmin, float& zmax){
+	if (mesh.V.empty())
+		return false;
+	float z = camera.state().getZ(mesh.center);
+	zmin = z - mesh.radius;
+	zmax = z + mesh.radius;
+	return true;
+}
+
+//the range of the depths under 1, converted at both ends only: the depth is monotonic in z
+bool DepthRange::visible(const float* depth, unsigned int count, Camera& camera, float& zmin, float& zmax, ThreadPool* pool){
+	float dmin, dmax;
+	reduce(pool, count, dmin, dmax, [&](unsigned int begin, unsigned int end, float& lo, float& hi){
+		vfloat one(1.f), vlo(INF), vhi(-INF);
+		unsigned int i = begin;
+		for (; i + vfloat::width <= end; i += vfloat::width){
+			vfloat d = vfloat::load(depth + i);
+			vmask drawn = d < one;
+			vlo = vmin(vlo, select(drawn, d, vfloat(INF)));
+			vhi = vmax(vhi, select(drawn, d, vfloat(-INF)));
+		}
+		lo = lanesMin(vlo);
+		hi = lanesMax(vhi);
+		for (; i < end; i++)
+			if (depth[i] < 1.f){
+				lo = min(lo, depth[i]);
+				hi = max(hi, depth[i]);
+			}
+	});
+	if (!(dmin <= dmax))
+		return false;
+	zmin = windowToZ(camera, dmin);
+	zmax = windowToZ(camera, dmax);
+	return true;
+}
+
+bool DepthRange::visible(const SoftRaster& raster, Camera& camera, float& zmin, float& zmax){
+	float dmin = INF, dmax = -INF;
+	for (unsigned int y = 0; y < raster.height(); y++)
+		for (unsigned int x = 0; x < raster.width(); x++){
+			float d = raster.depth(x, y);
+			if (d < 1.f){
+				dmin = min(dmin, d);
+				dmax = max(dmax, d);
+			}
+		}
+	if (!(dmin <= dmax))
+		return false;
+	zmin = windowToZ(camera, dmin);
+	zmax = windowToZ(camera, dmax);
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Camera.h"
+
+class ThreadPool;
+class SoftRaster;
+
+/// View depth range of a mesh, the range of Camera::getZ that the depth and focus modes
+/// are refocused on, three ways from the most to the least exact:
+/// - exact(): every vertex once, vfloat::width lanes at a time from the SoA copy of the
+///   vertices, in parallel chunks; the same range as CameraState::getZ over the vertices
+///   where contraction is off (FPContract.h). Vertices no triangle references would widen
+///   it: give it the copy referenced() makes when the mesh has some
+/// - bound(): from the bounding sphere of the mesh, in constant time; contains the exact
+///   range, by up to the radius on either side
+/// - visible(): from a depth buffer of the view, only what the pixels show; linear in the
+///   number of pixels whatever the size of the mesh
+/// Each returns false, leaving zmin and zmax alone, when there is nothing to measure.
+class DepthRange {
+public:
+	enum Strategy { EXACT, BOUND, VISIBLE };
+	static const char* name(Strategy strategy);
+
+	static bool exact(const VertexArrays& vertices, Camera& camera, float& zmin, float& zmax, ThreadPool* pool = nullptr);
+	//SoA copy of the vertices of mesh that a triangle references, for exact(); false, with
+	//vertices cleared, when that is all of them
+	static bool referenced(const Mesh& mesh, VertexArrays& vertices);
+	static bool bound(const Mesh& mesh, Camera& camera, float& zmin, float& zmax);
+	//depth: window depths in 0..1 (glReadPixels of GL_DEPTH_COMPONENT) drawn with the
+	//projection of camera, 1 being the background
+	static bool visible(const float* depth, unsigned int count, Camera& camera, float& zmin, float& zmax, ThreadPool* pool = nullptr);
+	static bool visible(const SoftRaster& raster, Camera& camera, float& zmin, float& zmax);
+
+	//Camera::getZ of the point seen at window depth d through the projection of camera
+	static float windowToZ(Camera& camera, float d);
+};
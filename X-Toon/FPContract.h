@@ -0,0 +1,18 @@
+#pragma once
+// Floating-point contraction off for the translation unit including this header.
+// Contraction fuses a * b + c into one FMA, rounded once instead of twice, where
+// the compiler sees fit: with FMA enabled (-march=native, /arch:AVX2) a scalar
+// expression and its vfloat counterpart, or the same expression in two functions,
+// may then round differently. The CPU shading, the depth range and the normals of
+// the mesh cache rely on one sequence of operations giving one value (FastMath.h),
+// so their sources include this header before anything else: GCC applies the
+// pragma to the functions defined after it, and does not inline across a change.
+// Building with -ffp-contract=off (GCC, Clang) has the same effect.
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#elif defined(_MSC_VER)
+#pragma fp_contract (off)
+#endif
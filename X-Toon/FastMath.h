@@ -0,0 +1,119 @@
+#pragma once
+// Approximate log2 / exp2 / pow for the X-Toon detail functions, and atan2
+// for the angle weights of the mesh normals.
+// The detail value only selects one of the 256 rows of the toon texture, so
+// libm precision is not needed; these kernels trade it for a handful of
+// multiply-adds and one division, with a bounded absolute error:
+//
+//   fastLog2 : x = 2^e * m, m in [sqrt(1/2), sqrt(2)), t = (m-1)/(m+1) and
+//              log2(m) = 2/ln2 * (t + t^3/3 + ... + t^9/9); |t| <= 0.1716 so
+//              the truncated series is off by less than 1e-9, the rest is
+//              float rounding (see FAST_LOG2_ERROR).
+//   fastExp2 : x = n + f, f in [-1/2, 1/2], 2^f by its degree 7 Taylor
+//              polynomial (relative remainder < 6e-9), 2^n built from bits.
+//   fastAtan2: the argument is reduced to a = min/max in [0, 1] and atan(a)
+//              taken from the degree 17 odd polynomial of Abramowitz & Stegun
+//              4.4.49 (|error| <= 2e-8), then unfolded to the right octant.
+//
+// The same template runs on float and on vfloat lanes, so the scalar and
+// the SIMD paths return identical values, provided the compiler does not
+// contract a * b + c into an FMA on one path only, as it does with FMA
+// enabled (-march=native): the sources using these include FPContract.h
+// first, which turns contraction off.
+
+#include <cmath>
+#include <cstring>
+#include "SIMD.h"
+
+// measured bounds, with margin, over every float in [2^-16, 2^16] for log2
+// and over [-126, 0] for exp2 (where pow(a, s) with a in [0,1] lands)
+const float FAST_LOG2_ERROR = 2e-6f;	// absolute
+const float FAST_EXP2_ERROR = 3e-7f;	// relative
+const float FAST_ATAN2_ERROR = 4e-7f;	// absolute, radians
+
+// scalar counterparts of the vfloat primitives in SIMD.h
+inline float select(bool m, float a, float b) { return m ? a : b; }
+inline float vfloor(float a) { return std::floor(a); }
+inline float vmin(float a, float b) { return b < a ? b : a; }
+inline float vmax(float a, float b) { return a < b ? b : a; }
+inline float vabs(float a) { return std::fabs(a); }
+inline float vexponent(float a) {
+	unsigned int bits;
+	std::memcpy(&bits, &a, 4);
+	return (float)((int)((bits >> 23) & 0xff) - 127);
+}
+inline float vmantissa(float a) {
+	unsigned int bits;
+	std::memcpy(&bits, &a, 4);
+	bits = (bits & 0x7fffff) | 0x3f800000;
+	float m;
+	std::memcpy(&m, &bits, 4);
+	return m;
+}
+inline float vexp2i(float n) {
+	unsigned int bits = (unsigned int)((int)n + 127) << 23;
+	float r;
+	std::memcpy(&r, &bits, 4);
+	return r;
+}
+
+// log2(x) for positive normal x
+template <class T>
+inline T fastLog2(T x) {
+	T e = vexponent(x);
+	T m = vmantissa(x);
+	auto big = m > T(1.41421356f);
+	m = select(big, m * T(0.5f), m);
+	e = select(big, e + T(1.f), e);
+	T t = (m - T(1.f)) / (m + T(1.f));
+	T t2 = t * t;
+	T p = T(0.320598898f);			// 2/(9 ln2)
+	p = p * t2 + T(0.412198583f);	// 2/(7 ln2)
+	p = p * t2 + T(0.577078016f);	// 2/(5 ln2)
+	p = p * t2 + T(0.961796694f);	// 2/(3 ln2)
+	p = p * t2 + T(2.88539008f);	// 2/ln2
+	return e + t * p;
+}
+
+// 2^x, x clamped to [-126, 127]
+template <class T>
+inline T fastExp2(T x) {
+	x = vmin(vmax(x, T(-126.f)), T(127.f));
+	T n = vfloor(x + T(0.5f));
+	T f = x - n;
+	T p = T(1.52527338e-5f);		// ln2^7/7!
+	p = p * f + T(1.54035304e-4f);
+	p = p * f + T(1.33335581e-3f);
+	p = p * f + T(9.61812911e-3f);
+	p = p * f + T(5.55041087e-2f);
+	p = p * f + T(0.240226507f);
+	p = p * f + T(0.693147181f);
+	p = p * f + T(1.f);
+	return p * vexp2i(n);
+}
+
+// a^s for a in [0,1] and s >= 0; a = 0 gives ~0 (exactly 1 when s = 0)
+template <class T>
+inline T fastPow(T a, float s) {
+	return fastExp2(T(s) * fastLog2(vmax(a, T(1e-30f))));
+}
+
+// atan2(y, x) for y >= 0, in [0, pi]; 0 when x = y = 0
+template <class T>
+inline T fastAtan2(T y, T x) {
+	T ax = vabs(x);
+	T hi = vmax(ax, y), lo = vmin(ax, y);
+	T a = select(hi > T(0.f), lo / hi, T(0.f));
+	T s = a * a;
+	T p = T(0.0028662257f);
+	p = p * s - T(0.0161657367f);
+	p = p * s + T(0.0429096138f);
+	p = p * s - T(0.0752896400f);
+	p = p * s + T(0.1065626393f);
+	p = p * s - T(0.1420889944f);
+	p = p * s + T(0.1999355085f);
+	p = p * s - T(0.3333314528f);
+	T r = a + a * s * p;
+	r = select(y > ax, T(1.57079633f) - r, r);
+	return select(x < T(0.f), T(3.14159265f) - r, r);
+}
@@ -5,6 +5,17 @@
 // --------------------------------------------------------------------------
 
 #include "GLProgram.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define printOpenGLError(X) printOglError ((X), __FILE__, __LINE__)
 /// Returns 1 if an OpenGL error occurred, 0 otherwise.
@@ -70,16 +81,28 @@
             _source = source;
         }
 
+        void Shader::setDefines (const std::string & defines) {
+            _defines = defines;
+        }
+
         void Shader::compile () {
-            const GLchar * tmp = _source.c_str();
-            glShaderSource (_id, 1, &tmp, NULL);
+            startCompile ();
+            checkCompile ();
+        }
+
+        void Shader::startCompile () {
+            const GLchar * tmp[2] = { _defines.c_str(), _source.c_str() };
+            glShaderSource (_id, 2, tmp, NULL);
             glCompileShader (_id);
             printOpenGLError ("Compiling Shader " + name ());  // Check for OpenGL errors
+        }
+
+        void Shader::checkCompile () {
             GLint shaderCompiled;
             glGetShaderiv (_id, GL_COMPILE_STATUS, &shaderCompiled);
             printOpenGLError ("Compiling Shader " + name ());  // Check for OpenGL errors
             if (!shaderCompiled)
-                throw Exception ("Error: shader not compiled. Info. Log.:\n" + infoLog () + "\nSource:\n" + _source);
+                throw Exception ("Error: shader not compiled. Info. Log.:\n" + infoLog () + "\nSource:\n" + _defines + _source);
         }
 
         void Shader::loadFromFile (const std::string & filename) {
@@ -119,12 +142,46 @@
             return infoLogStr;
         }
 
+        /// Program binaries need GL 4.1 or ARB_get_program_binary, and a format to store them in.
+        static bool programBinarySupported () {
+            if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+                return false;
+            GLint formats = 0;
+            glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            return formats > 0;
+        }
+
+        /// 64-bit FNV-1a, the terminating zero included so that successive strings cannot run into each other.
+        static void hashString (unsigned long long & h, const std::string & s) {
+            const char * c = s.c_str ();
+            for (size_t i = 0; i <= s.size (); i++) {
+                h ^= (unsigned char)c[i];
+                h *= 1099511628211ULL;
+            }
+        }
+
+        static std::string glString (GLenum name) {
+            const GLubyte * s = glGetString (name);
+            return s != NULL ? std::string ((const char *)s) : std::string ();
+        }
+
+        static const unsigned int BINARY_MAGIC = 0x42505458; // "XTPB"
+
+        GLuint Program::_inUse = 0;
+
+        std::string Program::_binaryCache = [] () -> std::string {
+            const char * env = getenv ("XTOON_SHADER_CACHE");
+            return env != NULL ? env : "shadercache";
+        } ();
+
         Program::Program (const std::string & name) {
 			_id = glCreateProgram();
 			_name = name;
 		}
 
         Program::~Program () {
+            if (_inUse == _id)
+                _inUse = 0;
             glDeleteProgram (_id);
         }
 
@@ -140,20 +197,35 @@
         }
 
         void Program::link () {
+            startLink ();
+            checkLink ();
+        }
+
+        void Program::startLink () {
+            if (!_binaryCache.empty () && programBinarySupported ())
+                glProgramParameteri (_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
             glLinkProgram (_id);
             printOpenGLError ("Linking Program " + name ());
+        }
+
+        void Program::checkLink () {
             GLint linked;
             glGetProgramiv (_id, GL_LINK_STATUS, &linked);
             if (!linked)
                 throw Exception ("Shaders not linked: " + infoLog ());
+            introspect ();
         }
 
         void Program::use () {
-            glUseProgram (_id);
+            if (_inUse != _id) {
+                glUseProgram (_id);
+                _inUse = _id;
+            }
         }
 
         void Program::stop () {
             glUseProgram (0);
+            _inUse = 0;
         }
 
         std::string Program::infoLog () {
@@ -172,119 +244,273 @@
             return infoLogStr;
         }
 
-        GLint Program::getUniformLocation (const std::string & uniformName) {
-            const GLchar * cname = uniformName.c_str ();
-            GLint loc = glGetUniformLocation (_id, cname);
-            if (loc == -1)
+        /// Components of a uniform type and whether they are set as floats or ints (samplers and
+        /// booleans are set as ints); 0 for the types the setters do not cover.
+        static unsigned int uniformComponents (GLenum type, GLenum & baseType) {
+            baseType = GL_FLOAT;
+            switch (type) {
+            case GL_FLOAT: return 1;
+            case GL_FLOAT_VEC2: return 2;
+            case GL_FLOAT_VEC3: return 3;
+            case GL_FLOAT_VEC4: return 4;
+            case GL_FLOAT_MAT4: return 16;
+            default: break;
+            }
+            baseType = GL_INT;
+            switch (type) {
+            case GL_INT: case GL_BOOL:
+            case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+            case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW:
+                return 1;
+            case GL_INT_VEC2: case GL_BOOL_VEC2: return 2;
+            case GL_INT_VEC3: case GL_BOOL_VEC3: return 3;
+            case GL_INT_VEC4: case GL_BOOL_VEC4: return 4;
+            default: break;
+            }
+            baseType = 0;
+            return 0;
+        }
+
+        static std::string uniformBaseName (const std::string & name) {
+            if (name.size () > 3 && name.compare (name.size () - 3, 3, "[0]") == 0)
+                return name.substr (0, name.size () - 3);
+            return name;
+        }
+
+        void Program::introspect () {
+            _uniforms.clear ();
+            _values.clear ();
+            GLint count = 0, maxLength = 0;
+            glGetProgramiv (_id, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv (_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<GLchar> buffer (maxLength + 1);
+            for (GLint i = 0; i < count; i++) {
+                GLsizei length = 0;
+                GLint size = 0;
+                GLenum type = 0, baseType;
+                glGetActiveUniform (_id, i, (GLsizei)buffer.size (), &length, &size, &type, &buffer[0]);
+                ActiveUniform u;
+                u.location = glGetUniformLocation (_id, &buffer[0]);
+                if (u.location < 0)
+                    continue; // built-in, or member of a uniform block
+                u.name = uniformBaseName (std::string (&buffer[0], length));
+                u.type = type;
+                u.words = uniformComponents (type, baseType);
+                u.offset = (unsigned int)_values.size ();
+                u.known = false;
+                _values.resize (_values.size () + u.words);
+                _uniforms.push_back (u);
+            }
+            std::sort (_uniforms.begin (), _uniforms.end (),
+                       [] (const ActiveUniform & a, const ActiveUniform & b) { return a.name < b.name; });
+            printOpenGLError ("Reading the uniforms of Program " + name ());
+        }
+
+        int Program::find (const std::string & uniformName) const {
+            std::string key = uniformBaseName (uniformName);
+            std::vector<ActiveUniform>::const_iterator it =
+                std::lower_bound (_uniforms.begin (), _uniforms.end (), key,
+                                  [] (const ActiveUniform & a, const std::string & n) { return a.name < n; });
+            if (it == _uniforms.end () || it->name != key)
+                return -1;
+            return (int)(it - _uniforms.begin ());
+        }
+
+        int Program::index (const std::string & uniformName) {
+            int i = find (uniformName);
+            if (i < 0)
                 throw Exception (std::string ("Program Error: No such uniform named ") + uniformName);
-            printOpenGLError ("Wrong Uniform Variable [" + uniformName + "] for Program [" + name () + "]");
-            return loc;
+            return i;
+        }
+
+        /// Linear: the location setters are not on the hot path, the handles are.
+        int Program::index (GLint location) const {
+            for (unsigned int i = 0; i < _uniforms.size (); i++)
+                if (_uniforms[i].location == location)
+                    return (int)i;
+            return -1;
+        }
+
+        int Program::resolve (const std::string & uniformName, GLenum baseType, unsigned int components) {
+            int i = find (uniformName);
+            if (i < 0)
+                return -1;
+            GLenum uniformBaseType;
+            if (uniformComponents (_uniforms[i].type, uniformBaseType) != components || uniformBaseType != baseType)
+                throw Exception ("Program Error: Wrong type for a handle on uniform " + uniformName + " of Program " + name ());
+            return i;
+        }
+
+        /// Records values as the last ones uploaded to the uniform, returning whether they differ
+        /// from those; unknown uniforms, and a number of words not matching the type, always upload.
+        bool Program::changed (int i, const void * values, unsigned int words) {
+            if (i < 0 || words != _uniforms[i].words)
+                return true;
+            ActiveUniform & u = _uniforms[i];
+            GLint * last = &_values[u.offset];
+            if (u.known && memcmp (last, values, words * sizeof (GLint)) == 0)
+                return false;
+            memcpy (last, values, words * sizeof (GLint));
+            u.known = true;
+            return true;
+        }
+
+        GLint Program::getUniformLocation (const std::string & uniformName) {
+            return _uniforms[index (uniformName)].location;
         }
 
         void Program::setUniform1f (GLint location, float value) {
+            if (!changed (index (location), &value, 1))
+                return;
             use ();
             glUniform1f (location, value);
         }
 
         void Program::setUniform1f (const std::string & name, float value) {
-            use ();
-            glUniform1f (getUniformLocation (name), value);
+            set (Uniform<float> (index (name)), value);
         }
 
         void Program::setUniform2f (GLint location, float value0, float value1) {
+            const float values[2] = { value0, value1 };
+            if (!changed (index (location), values, 2))
+                return;
             use ();
             glUniform2f (location, value0, value1);
         }
 
         void Program::setUniform2f (const std::string & name, float value0, float value1) {
-            use ();
-            glUniform2f (getUniformLocation (name), value0, value1);
+            set (Uniform<float, 2> (index (name)), value0, value1);
         }
 
         void Program::setUniform3f (GLint location, float value0, float value1, float value2) {
+            const float values[3] = { value0, value1, value2 };
+            if (!changed (index (location), values, 3))
+                return;
             use ();
             glUniform3f (location, value0, value1, value2);
         }
 
         void Program::setUniform3f (const std::string & name, float value0, float value1, float value2) {
-            use ();
-            glUniform3f (getUniformLocation (name), value0, value1, value2);
+            set (Uniform<float, 3> (index (name)), value0, value1, value2);
         }
 
         void Program::setUniform4f (GLint location, float value0, float value1, float value2, float value3) {
+            const float values[4] = { value0, value1, value2, value3 };
+            if (!changed (index (location), values, 4))
+                return;
             use ();
             glUniform4f (location, value0, value1, value2, value3);
         }
 
         void Program::setUniform4f (const std::string & name, float value0, float value1, float value2, float value3) {
-            use ();
-            glUniform4f (getUniformLocation (name), value0, value1, value2, value3);
+            set (Uniform<float, 4> (index (name)), value0, value1, value2, value3);
         }
 
         void Program::setUniformMatrix4fv (GLint location, const float * values) {
+            if (!changed (index (location), values, 16))
+                return;
             use ();
             glUniformMatrix4fv (location, 1, GL_FALSE, values);
         }
 
         void Program::setUniformMatrix4fv (const std::string & name, const float * values) {
-            use ();
-            setUniformMatrix4fv (getUniformLocation (name), values);
+            set (Uniform<float, 16> (index (name)), values);
         }
 
         void Program::setUniformNf (GLint location, unsigned int numValues, const float * values) {
+            if (numValues < 1 || numValues > 4)
+                throw Exception ("Program Error: Wrong number of values to set for uniform float array.");
+            if (!changed (index (location), values, numValues))
+                return;
             use ();
             switch (numValues) {
             case 1: glUniform1f (location, values[0]); break;
             case 2: glUniform2f (location, values[0], values[1]); break;
             case 3: glUniform3f (location, values[0], values[1], values[2]); break;
             case 4: glUniform4f (location, values[0], values[1], values[2], values[3]); break;
-            default: throw Exception ("Program Error: Wrong number of values to set for uniform float array."); break;
             }
         }
 
         void Program::setUniformNf (const std::string & name, unsigned int numValues, const float * values) {
-            use ();
-            GLint loc = getUniformLocation (name);
-            switch (numValues) {
-            case 1: glUniform1f (loc, values[0]); break;
-            case 2: glUniform2f (loc, values[0], values[1]); break;
-            case 3: glUniform3f (loc, values[0], values[1], values[2]); break;
-            case 4: glUniform4f (loc, values[0], values[1], values[2], values[3]); break;
-            default: throw Exception ("Wrong number of values to set for uniform float array " + name + "."); break;
-            }
+            if (numValues < 1 || numValues > 4)
+                throw Exception ("Wrong number of values to set for uniform float array " + name + ".");
+            setUniformNf (getUniformLocation (name), numValues, values);
         }
 
         void Program::setUniform1i (GLint location, int value) {
+            if (!changed (index (location), &value, 1))
+                return;
             use ();
             glUniform1i (location, value);
         }
 
         void Program::setUniform1i (const std::string & name, int value) {
-            use ();
-            glUniform1i (getUniformLocation (name), value);
+            set (Uniform<int> (index (name)), value);
         }
 
         void Program::setUniformNi (GLint location, unsigned int numValues, const int * values) {
+            if (numValues < 1 || numValues > 4)
+                throw Exception ("Program Error: Wrong number of values to set for uniform int array.");
+            if (!changed (index (location), values, numValues))
+                return;
             use ();
             switch (numValues) {
             case 1: glUniform1i (location, values[0]); break;
             case 2: glUniform2i (location, values[0], values[1]); break;
             case 3: glUniform3i (location, values[0], values[1], values[2]); break;
             case 4: glUniform4i (location, values[0], values[1], values[2], values[3]); break;
-            default: throw Exception ("Program Error: Wrong number of values to set for uniform int array."); break;
             }
         }
 
         void Program::setUniformNi (const std::string & name, unsigned int numValues, const int * values) {
+            if (numValues < 1 || numValues > 4)
+                throw Exception ("Program Error: Wrong number of values to set for uniform int array " + name + ".");
+            setUniformNi (getUniformLocation (name), numValues, values);
+        }
+
+        void Program::set (Uniform<float> u, float value) {
+            if (!u.valid () || !changed (u._index, &value, 1))
+                return;
             use ();
-            GLint loc = getUniformLocation (name);
-            switch (numValues) {
-            case 1: glUniform1i (loc, values[0]); break;
-            case 2: glUniform2i (loc, values[0], values[1]); break;
-            case 3: glUniform3i (loc, values[0], values[1], values[2]); break;
-            case 4: glUniform4i (loc, values[0], values[1], values[2], values[3]); break;
-            default: throw Exception ("Program Error: Wrong number of values to set for uniform int array " + name + "."); break;
-            }
+            glUniform1f (_uniforms[u._index].location, value);
+        }
+
+        void Program::set (Uniform<float, 2> u, float value0, float value1) {
+            const float values[2] = { value0, value1 };
+            if (!u.valid () || !changed (u._index, values, 2))
+                return;
+            use ();
+            glUniform2f (_uniforms[u._index].location, value0, value1);
+        }
+
+        void Program::set (Uniform<float, 3> u, float value0, float value1, float value2) {
+            const float values[3] = { value0, value1, value2 };
+            if (!u.valid () || !changed (u._index, values, 3))
+                return;
+            use ();
+            glUniform3f (_uniforms[u._index].location, value0, value1, value2);
+        }
+
+        void Program::set (Uniform<float, 4> u, float value0, float value1, float value2, float value3) {
+            const float values[4] = { value0, value1, value2, value3 };
+            if (!u.valid () || !changed (u._index, values, 4))
+                return;
+            use ();
+            glUniform4f (_uniforms[u._index].location, value0, value1, value2, value3);
+        }
+
+        void Program::set (Uniform<float, 16> u, const float * values) {
+            if (!u.valid () || !changed (u._index, values, 16))
+                return;
+            use ();
+            glUniformMatrix4fv (_uniforms[u._index].location, 1, GL_FALSE, values);
+        }
+
+        void Program::set (Uniform<int> u, int value) {
+            if (!u.valid () || !changed (u._index, &value, 1))
+                return;
+            use ();
+            glUniform1i (_uniforms[u._index].location, value);
         }
 
         void Program::reload () {
@@ -295,24 +521,125 @@
             link ();
         }
 
+        void Program::setBinaryCache (const std::string & directory) {
+            _binaryCache = directory;
+        }
+
+        const std::string & Program::binaryCache () {
+            return _binaryCache;
+        }
+
+        /// The cache file of the attached shaders on this driver, "" when the cache is off or
+        /// the driver has no binaries; key is the hash it is named after.
+        std::string Program::binaryFilename (unsigned long long & key) const {
+            if (_binaryCache.empty () || !programBinarySupported ())
+                return "";
+            key = 14695981039346656037ULL;
+            for (unsigned int i = 0; i < _shaders.size (); i++) {
+                hashString (key, std::to_string (_shaders[i]->type ()));
+                hashString (key, _shaders[i]->defines ());
+                hashString (key, _shaders[i]->source ());
+            }
+            hashString (key, glString (GL_VENDOR));
+            hashString (key, glString (GL_RENDERER));
+            hashString (key, glString (GL_VERSION));
+            char name[32];
+            snprintf (name, sizeof (name), "%016llx.bin", key);
+            return _binaryCache + "/" + name;
+        }
+
+        /// File: magic, key, binary format and length, then the binary.
+        bool Program::loadBinary () {
+            unsigned long long key = 0, fileKey = 0;
+            std::string filename = binaryFilename (key);
+            if (filename.empty ())
+                return false;
+            std::ifstream in (filename.c_str (), std::ios::binary);
+            unsigned int magic = 0, length = 0;
+            GLenum format = 0;
+            in.read ((char *)&magic, sizeof (magic));
+            in.read ((char *)&fileKey, sizeof (fileKey));
+            in.read ((char *)&format, sizeof (format));
+            in.read ((char *)&length, sizeof (length));
+            if (!in || magic != BINARY_MAGIC || fileKey != key || length == 0)
+                return false;
+            std::vector<char> binary (length);
+            if (!in.read (&binary[0], length))
+                return false;
+            glProgramBinary (_id, format, &binary[0], (GLsizei)length);
+            while (glGetError () != GL_NO_ERROR)
+                ; // a format the driver no longer knows is only a cache miss
+            GLint linked = 0;
+            glGetProgramiv (_id, GL_LINK_STATUS, &linked);
+            if (!linked)
+                return false;
+            introspect ();
+            return true;
+        }
+
+        /// Written aside then renamed, so that concurrent processes never read half a file.
+        bool Program::saveBinary () {
+            unsigned long long key = 0;
+            std::string filename = binaryFilename (key);
+            if (filename.empty ())
+                return false;
+            GLint length = 0;
+            glGetProgramiv (_id, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length <= 0)
+                return false;
+            std::vector<char> binary (length);
+            GLenum format = 0;
+            glGetProgramBinary (_id, length, &length, &format, &binary[0]);
+            if (printOpenGLError ("Reading the binary of Program " + name ()))
+                return false;
+#ifdef _WIN32
+            _mkdir (_binaryCache.c_str ());
+            std::string tmp = filename + "." + std::to_string (_getpid ()) + ".tmp";
+#else
+            mkdir (_binaryCache.c_str (), 0777);
+            std::string tmp = filename + "." + std::to_string (getpid ()) + ".tmp";
+#endif
+            std::ofstream out (tmp.c_str (), std::ios::binary);
+            unsigned int size = (unsigned int)length;
+            out.write ((const char *)&BINARY_MAGIC, sizeof (BINARY_MAGIC));
+            out.write ((const char *)&key, sizeof (key));
+            out.write ((const char *)&format, sizeof (format));
+            out.write ((const char *)&size, sizeof (size));
+            out.write (&binary[0], size);
+            out.close ();
+            if (!out || std::rename (tmp.c_str (), filename.c_str ()) != 0) {
+                std::remove (tmp.c_str ()); // on Windows, when another process stored it first
+                return false;
+            }
+            return true;
+        }
+
         Program * Program::genVFProgram (const std::string & name,
                                          const std::string & vertexShaderFilename,
-                                         const std::string & fragmentShaderFilename) {
+                                         const std::string & fragmentShaderFilename,
+                                         const std::string & defines) {
 			Program * p = new Program (name);
             Shader * vs = new Shader (name + " Vertex Shader", GL_VERTEX_SHADER);
             Shader * fs = new Shader (name + " Fragment Shader",GL_FRAGMENT_SHADER);
+            vs->setDefines (defines);
+            fs->setDefines (defines);
             vs->loadFromFile (vertexShaderFilename);
 			std::cout << "vertex shader: [" + vertexShaderFilename + "] loaded successfully" << std::endl;
-            vs->compile ();
             p->attach(vs);
-			std::cout << "vertex shader compiled successfully" << std::endl;
             fs->loadFromFile (fragmentShaderFilename);
 			std::cout << "fragment shader: [" + fragmentShaderFilename + "] loaded successfully" << std::endl;
-            fs->compile ();
             p->attach(fs);
+            if (p->loadBinary ()) {
+                std::cout << "linked from the binary cache" << std::endl;
+                return p;
+            }
+            vs->compile ();
+			std::cout << "vertex shader compiled successfully" << std::endl;
+            fs->compile ();
 			std::cout << "fragment shader compiled successfully" << std::endl;
             p->link();
 			std::cout << "linked successfully" << std::endl;
+            p->saveBinary ();
             //p->use ();
             return p;
         }
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <type_traits>
 
 class Exception {
  public:
@@ -32,7 +33,14 @@ public:
   inline const std::string & source () const { return _source; }
   inline const std::string & filename () const { return _filename; }
   void setSource (const std::string & source);
+  /// Preprocessor lines compiled in front of the source (e.g. "#define NAME\n").
+  void setDefines (const std::string & defines);
+  inline const std::string & defines () const { return _defines; }
   void compile ();
+  /// compile () in two steps, to compile several shaders at once: startCompile () hands
+  /// the source over to the driver, checkCompile () waits for it and throws on failure.
+  void startCompile ();
+  void checkCompile ();
   void loadFromFile (const std::string & filename);
   void reload ();
  protected:
@@ -43,8 +51,27 @@ public:
   GLuint _type;
   std::string _filename;
   std::string _source;
+  std::string _defines;
 };
 
+/// Active uniform of a Program, resolved once by name with Program::uniform ():
+/// T is float or int, N the number of components (16 for a mat4). Setting it
+/// through Program::set () looks nothing up. A default handle, or that of a
+/// uniform the linker removed, is invalid and sets nothing.
+template <typename T, unsigned int N = 1>
+class Uniform {
+public:
+  inline Uniform () : _index (-1) {}
+  inline bool valid () const { return _index >= 0; }
+private:
+  friend class Program;
+  inline explicit Uniform (int index) : _index (index) {}
+  int _index;
+};
+
+/// The active uniforms are read once after link () into a table sorted by name,
+/// which the setters look up instead of glGetUniformLocation. The last value
+/// uploaded to each is kept, and setting the same value again uploads nothing.
 class Program {
 public:
   Program (const std::string & name);
@@ -54,9 +81,25 @@ public:
   void attach (Shader * shader);
   void detach (Shader * shader);
   void link ();
+  /// link () in two steps, as Shader::startCompile () and Shader::checkCompile ().
+  void startLink ();
+  void checkLink ();
   void use ();
   static void stop ();
   GLint getUniformLocation (const std::string & uniformName);
+  /// Handle on the active uniform name, invalid when the program has none (it may
+  /// have been optimized out); throws if its type is not N components of T.
+  /// Handles hold until the next link () or reload ().
+  template <typename T, unsigned int N>
+  inline Uniform<T, N> uniform (const std::string & name) {
+    return Uniform<T, N> (resolve (name, std::is_same<T, int>::value ? GL_INT : GL_FLOAT, N));
+  }
+  void set (Uniform<float> u, float value);
+  void set (Uniform<float, 2> u, float value0, float value1);
+  void set (Uniform<float, 3> u, float value0, float value1, float value2);
+  void set (Uniform<float, 4> u, float value0, float value1, float value2, float value3);
+  void set (Uniform<float, 16> u, const float * values);
+  void set (Uniform<int> u, int value);
   void setUniform1f (GLint location, float value);
   void setUniform1f (const std::string & name, float value);
   void setUniform2f (GLint location, float value0, float value1);
@@ -74,14 +117,49 @@ public:
   void setUniformNi (GLint location, unsigned int numValues, const int * values);
   void setUniformNi (const std::string & name, unsigned int numValues, const int * values);
   void reload ();
+  /// On-disk cache of linked programs (glGetProgramBinary), a file per set of shader
+  /// sources and driver in directory; "" turns it off. By default the directory named by
+  /// the XTOON_SHADER_CACHE environment variable if set, else "shadercache".
+  static void setBinaryCache (const std::string & directory);
+  static const std::string & binaryCache ();
+  /// Links the attached shaders, their sources loaded, from the binary cache: true when it
+  /// holds a binary of these sources for this driver and the driver takes it, the shaders
+  /// need not be compiled then. Otherwise (none, or rejected after a driver update) false:
+  /// compile, link and saveBinary ().
+  bool loadBinary ();
+  /// Stores the program, linked, in the binary cache; false when it could not.
+  bool saveBinary ();
   // generate a simple program, with only vertex and fragment shaders.
+  // defines are compiled in front of both shader sources.
+  // linked from the binary cache when it has the program.
   static Program * genVFProgram (const std::string & name,
 				 const std::string & vertexShaderFilename,
-				 const std::string & fragmentShaderFilename);
+				 const std::string & fragmentShaderFilename,
+				 const std::string & defines = "");
  protected:
   std::string infoLog ();
  private:
+  struct ActiveUniform {
+    std::string name;     // without the [0] of arrays
+    GLint location;
+    GLenum type;
+    unsigned int offset;  // of the last value uploaded in _values
+    unsigned int words;   // components of type
+    bool known;           // whether _values holds it
+  };
   GLuint _id;
   std::string _name;
   std::vector<Shader*>_shaders;
+  std::vector<ActiveUniform> _uniforms;  // sorted by name
+  std::vector<GLint> _values;            // last values uploaded, float ones bitwise
+  static GLuint _inUse;                  // program last passed to glUseProgram
+  static std::string _binaryCache;
+
+  void introspect ();
+  int find (const std::string & name) const;
+  int index (const std::string & name);
+  int index (GLint location) const;
+  int resolve (const std::string & name, GLenum baseType, unsigned int components);
+  bool changed (int index, const void * values, unsigned int words);
+  std::string binaryFilename (unsigned long long & key) const;
 };
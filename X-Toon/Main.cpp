@@ -15,14 +15,24 @@
 #include <ctime>
 #include <algorithm>
 #include <cmath>
+#include <chrono>
 #include <GL/glew.h>
 #include <GL/glut.h>
 
 #include "Vec3.h"
 #include "Camera.h"
 #include "Mesh.h"
+#include "MeshGPU.h"
 #include "Light.h"
 #include "XToon.h"
+#include "ThreadPool.h"
+#include "SoftRaster.h"
+#include "Meshlets.h"
+#include "BVH.h"
+#include "MeshLOD.h"
+#include "MeshStream.h"
+#include "DepthRange.h"
+#include "AutoFocus.h"
 #include "EasyBMP/EasyBMP.h"
 
 #define M_PI 3.14159265358979323846
@@ -37,7 +47,7 @@ static const string DEFAULT_MESH_FILE("models/bunny.off");	//normal
 static string appTitle ("X-Toon NPR shading");
 static GLint window;
 static unsigned int FPS = 0;
-static bool fullScreen = false, changeLight = false;
+static bool fullScreen = false, changeLight = false, cullMeshlets = true, useLOD = true, autoFocus = false;
 static float nearplane = 1, farplane = 100, 
 	zmind = 1, zmaxd = 100,
 	zmin = 0.f,zmax = 2.5f,zfoc = 7,
@@ -45,6 +55,22 @@ static float nearplane = 1, farplane = 100,
 
 static Camera camera(nearplane, farplane);
 static Mesh mesh;
+static MeshLOD lod;				// coarser triangle lists of mesh over prefixes of mesh.V
+static MeshGPU meshGPU;			// VBO/IBO copy of mesh, uploaded once
+static VertexArrays vertexArrays;	// SoA copy of mesh.V for the batched CPU shading
+static VertexArrays referencedArrays;	// and of the vertices of its triangles,
+static bool strayVertices = false;	// when some vertices are in none
+static vector<float> colors;		// per-vertex rgb filled by the CPU shading pass
+static Meshlets meshlets;			// clusters of mesh culled before the CPU shading
+static vector<unsigned int> shadeList;	// vertices of the meshlets left by the culling
+static BVH bvh;					// triangle hierarchy for picking, built on first use
+static DepthRange::Strategy depthStrategy = DepthRange::EXACT;	// how refocusing measures the depth range
+static vector<float> depthPixels;	// GL depth buffer read back for DepthRange::VISIBLE
+static AutoFocus focusStats;		// depth statistics of the frames shown, for the automatic refocusing
+static GLuint depthPBO[2] = { 0, 0 };	// depth buffers of the last two frames read back without waiting
+static unsigned int depthPBOWidth[2], depthPBOHeight[2];
+static Camera depthPBOCamera[2];	// camera each of them was drawn with
+static unsigned int depthReads = 0;	// frames read back since the automatic refocusing was switched on
 
 clock_t start = clock();
 
@@ -57,18 +83,28 @@ Light lights[LIGHTSIZE] = {light0,light1};
 //XToon xtoon("texture2D/fb2.bmp", light0.position, &camera);	//FOCUS
 XToon xtoon("texture2D/ns3.bmp", light0.position, &camera);	//SILHOUETTE
 //XToon xtoon("texture2D/hl1.bmp", light0.position, &camera);	//HIGHLIGHT
+static const bool USE_SHADER = false;	//X-Toon in the fragment shaders (true) or on the CPU (false)
 
 void printUsage () {
 	std::cerr << std::endl
 		<< appTitle << std::endl
 		<< "By: Yuesong Shen" << std::endl << std::endl
 		<< "Based on code provided by professor Tamy Boubekeur" << std::endl << std::endl
-		<< "Usage: ./main [<file.off>]" << std::endl
+		<< "Usage: ./main [<file.off>] [-o <image.bmp> [<width> <height>] [-stream]]" << std::endl
+		<< "    -o: render one image on the CPU to <image.bmp> and exit, without a window" << std::endl
+		<< "    -stream: with -o, stream the mesh from its binary cache instead of loading it" << std::endl
+		<< "             (for meshes larger than memory)" << std::endl
 		<< "Commands:" << std::endl<< std::endl
 		<< "-- general:" << std::endl
 		<< "    ?: Print help" << std::endl
+		<< "    a: switch on/off approximate log/pow" << std::endl
+		<< "    b: switch on/off bilinear texture lookup (CPU shading)" << std::endl
+		<< "    c: switch on/off meshlet culling (CPU shading)" << std::endl
+		<< "    d: switch on/off levels of detail" << std::endl
 		<< "    l: switch on/off light position change" << std::endl
 		<< "    r: refocus (for depth/focus shader)" << std::endl
+		<< "    o: switch on/off automatic refocusing, following the camera (for depth/focus shader)" << std::endl
+		<< "    v: cycle the depth range of refocusing: exact, bounding sphere, visible pixels" << std::endl
 		<< "    s: screen shot" << std::endl
 		<< "    w: Toggle wireframe mode" << std::endl
 		<< "    q, <esc>: Quit" << std::endl << std::endl
@@ -76,11 +112,62 @@ void printUsage () {
 		<< "    <left button drag>: rotate model" << std::endl
 		<< "    <right button drag>: move model" << std::endl
 		<< "    <middle button drag>: zoom" << std::endl
-		<< "    <left button drag> + <right button click>: zoom" << std::endl << std::endl
+		<< "    <left button drag> + <right button click>: zoom" << std::endl
+		<< "    <shift> + <left button click>: focus on the point under the cursor (for focus shader)," << std::endl
+		<< "                                   kept in focus with automatic refocusing" << std::endl << std::endl
 		<< "-- light position change on:" << std::endl
 		<< "    <click button>: change light position" << std::endl << std::endl;
 }
 
+//set xtoon, enableShader = false for the CPU implementation
+void initXToon(bool enableShader){
+	//xtoon.setForDepth(&zmind, &zmaxd, enableShader);		//DEPTH
+	//xtoon.setForFocus(&zfoc, &zmin, &zmax, enableShader);	//FOCUS
+	xtoon.setForSilhouette(&r, enableShader);	//SILHOUETTE
+	//xtoon.setForHighlight(&s, enableShader);	//HIGHLIGHT
+}
+
+//load the model (reordered for the vertex caches, with its levels of detail, through the binary cache),
+//or quit telling why it could not be read
+void loadMesh(const char * modelFilename){
+	string error;
+	if (!mesh.load(modelFilename, &error, &ThreadPool::global(), true, &lod)){
+		cerr << "Error loading mesh: " << error << endl;
+		exit(1);
+	}
+}
+
+//build the GPU buffers and the shading arrays, once per loaded mesh
+void initBuffers(){
+	meshGPU.upload(mesh, &lod);
+	vertexArrays.build(mesh.V);
+	strayVertices = DepthRange::referenced(mesh, referencedArrays);
+	colors.resize(3 * mesh.V.size());
+	meshlets.build(mesh);
+	bvh = BVH();
+}
+
+//the hierarchy of mesh, built at the first pick (picking is occasional)
+const BVH& meshBVH(){
+	if (bvh.size() == 0 && !mesh.T.empty())
+		bvh.build(mesh, &ThreadPool::global());
+	return bvh;
+}
+
+//set the focus depth to the depth of the surface seen through the pixel (x, y)
+void pickFocus(int x, int y){
+	BVH::Hit hit;
+	if (!meshBVH().pick(mesh, camera, x, y, hit)){
+		cout << "** no surface under the cursor.\n";
+		return;
+	}
+	const Triangle& t = mesh.T[hit.triangle];
+	Vec3f p = mesh.V[t.v[0]].p * (1.f - hit.u - hit.v) + mesh.V[t.v[1]].p * hit.u + mesh.V[t.v[2]].p * hit.v;
+	zfoc = camera.getZ(p);
+	xtoon.refresh();
+	cout << "** focus on triangle " << hit.triangle << " at depth " << zfoc << ".\n";
+}
+
 void init(const char * modelFilename) {
 	glewInit();
 	glCullFace(GL_BACK);     // Specifies the faces to cull (here the ones pointing away from the camera)
@@ -94,39 +181,142 @@ void init(const char * modelFilename) {
 	//glClearColor (.0f, .0f, .0f, 1.0f);
 	
 	//set xtoon
-
-	//xtoon.setForDepth(&zmind, &zmaxd);		//DEPTH + shader implementation
-	//xtoon.setForFocus(&zfoc, &zmin, &zmax);	//FOCUS + shader implementation
-	//xtoon.setForSilhouette(&r);	//SILHOUETTE + shader implementation
-	//xtoon.setForHighlight(&s);	//HIGHLIGHT + shader implementation
-	
-	//xtoon.setForDepth(&zmind, &zmaxd,false);	//DEPTH no shader implementation
-	//xtoon.setForFocus(&zfoc, &zmin, &zmax, false);	//FOCUS no shader implementation
-	xtoon.setForSilhouette(&r, false);	//SILHOUETTE no shader implementation
-	//xtoon.setForHighlight(&s, false);	//HIGHLIGHT no shader implementation
+	initXToon(USE_SHADER);
 	
-	mesh.loadOFF(modelFilename);
+	loadMesh(modelFilename);
+	initBuffers();
     camera.resize (DEFAULT_SCREENWIDTH, DEFAULT_SCREENHEIGHT);
 }
 
+bool cpuShading(){
+	XToon::ShaderState s = xtoon.state();
+	return s == XToon::CPUDEPTH || s == XToon::CPUFOCUS || s == XToon::CPUSILHOUETTE || s == XToon::CPUHIGHLIGHT;
+}
+
+//shade the first count vertices of the mesh once into colors (CPU rendering), on all cores
+void shadeVertices(unsigned int count){
+	xtoon.getBatch(count,
+		&vertexArrays.px[0], &vertexArrays.py[0], &vertexArrays.pz[0],
+		&vertexArrays.nx[0], &vertexArrays.ny[0], &vertexArrays.nz[0], &colors[0],
+		&ThreadPool::global());
+}
+
+//shade only the vertices of the meshlets that may be seen: the colours of the others
+//are kept, their triangles being back-facing or out of view
+void shadeVisibleVertices(){
+	meshlets.cull(camera, &ThreadPool::global());
+	meshlets.visibleVertices(shadeList);
+	xtoon.beginFrame();
+	ThreadPool::global().parallelFor(shadeList.size(), 1024, [&](unsigned int begin, unsigned int end){
+		thread_local VertexArrays span;
+		thread_local vector<float> rgb;
+		unsigned int n = end - begin;
+		span.resize(n);
+		rgb.resize(3 * n);
+		for (unsigned int k = 0; k < n; k++){
+			unsigned int v = shadeList[begin + k];
+			span.px[k] = vertexArrays.px[v]; span.py[k] = vertexArrays.py[v]; span.pz[k] = vertexArrays.pz[v];
+			span.nx[k] = vertexArrays.nx[v]; span.ny[k] = vertexArrays.ny[v]; span.nz[k] = vertexArrays.nz[v];
+		}
+		xtoon.getBatch(n, &span.px[0], &span.py[0], &span.pz[0], &span.nx[0], &span.ny[0], &span.nz[0], &rgb[0]);
+		for (unsigned int k = 0; k < n; k++)
+			for (int c = 0; c < 3; c++)
+				colors[3 * shadeList[begin + k] + c] = rgb[3 * k + c];
+	});
+}
+
+//the meshlets only cover the full mesh; a coarser level shades the prefix of V it uses
 void drawScene(){
-	Vec3f clr, campos;
-	camera.getPos(campos);
-    glBegin (GL_TRIANGLES);
-    for (unsigned int i = 0; i < mesh.T.size(); i++) 
-        for (unsigned int j = 0; j < 3; j++) {
-            const Vertex & v = mesh.V[mesh.T[i].v[j]];
-
-			//clr = xtoon.get(v.p, v.n, xtoon.getForDepth(v.p));	//DEPTH no shader implementation
-			//clr = xtoon.get(v.p, v.n, xtoon.getForFocus(v.p));	//FOCUS no shader implementation
-			clr = xtoon.get(v.p, v.n, xtoon.getForSilhouette(v.p,v.n));	//SILHOUETTE no shader implementation
-			//clr = xtoon.get(v.p, v.n, xtoon.getForHighlight(v.p,v.n));	//HIGHLIGHT no shader implementation
-
-			glColor3f (clr[0], clr[1], clr[2]);	//CPU rendering
-            glNormal3f (v.n[0], v.n[1], v.n[2]); // Specifies current normal vertex   
-            glVertex3f (v.p[0], v.p[1], v.p[2]); // Emit a vertex (one triangle is emitted each time 3 vertices are emitted)
-        }
-    glEnd ();
+	bool cpu = cpuShading();
+	unsigned int level = useLOD ? lod.select(mesh, camera) : 0;
+	if (cpu && !mesh.V.empty()){
+		unsigned int count = lod.numVertices(mesh, level);
+		if (level == 0 && cullMeshlets)
+			shadeVisibleVertices();
+		else
+			shadeVertices(count);
+		meshGPU.updateColors(&colors[0], count);
+	}
+	meshGPU.draw(cpu, level);
+}
+
+//view depth range of the mesh as depthStrategy measures it, widened to [nearplane, farplane]
+//when it lies inside; the visible range reads back the depth buffer of a fresh frame
+void depthBounds(float& minz, float& maxz){
+	float lo, hi;
+	bool found;
+	minz = farplane;
+	maxz = nearplane;
+	if (depthStrategy == DepthRange::EXACT)
+		found = DepthRange::exact(strayVertices ? referencedArrays : vertexArrays,
+			camera, lo, hi, &ThreadPool::global());
+	else if (depthStrategy == DepthRange::BOUND)
+		found = DepthRange::bound(mesh, camera, lo, hi);
+	else {
+		unsigned int w = camera.getScreenWidth(), h = camera.getScreenHeight();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		camera.apply();
+		drawScene();
+		depthPixels.resize(w * h);
+		glReadPixels(0, 0, w, h, GL_DEPTH_COMPONENT, GL_FLOAT, &depthPixels[0]);
+		found = DepthRange::visible(&depthPixels[0], w * h, camera, lo, hi, &ThreadPool::global());
+	}
+	if (found){
+		minz = min(minz, lo);
+		maxz = max(maxz, hi);
+	}
+}
+
+//read the depth buffer of the frame into one of two pixel buffers, without waiting for the
+//transfer, and hand the one read the frame before, done by now, over to focusStats
+void readDepthAsync(){
+	unsigned int w = camera.getScreenWidth(), h = camera.getScreenHeight();
+	unsigned int current = depthReads & 1, previous = current ^ 1;
+	if (depthPBO[0] == 0)
+		glGenBuffers(2, depthPBO);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPBO[current]);
+	if (depthPBOWidth[current] != w || depthPBOHeight[current] != h){
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * sizeof(float), nullptr, GL_STREAM_READ);
+		depthPBOWidth[current] = w;
+		depthPBOHeight[current] = h;
+	}
+	glReadPixels(0, 0, w, h, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	depthPBOCamera[current] = camera;
+	if (depthReads > 0){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPBO[previous]);
+		const float* depth = (const float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (depth != nullptr){
+			focusStats.submit(depth, depthPBOWidth[previous], depthPBOHeight[previous], depthPBOCamera[previous]);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	depthReads++;
+}
+
+//ease the depth or focus parameters toward the statistics of the latest frame measured:
+//the percentile range for the depth, the point under the cursor (or the middle of the
+//screen) in focus with a quarter of that range on either side, as 'r' does
+void refocusAuto(){
+	static chrono::steady_clock::time_point last = chrono::steady_clock::now();
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	float dt = chrono::duration<float>(now - last).count();
+	last = now;
+	if (!focusStats.update(dt))
+		return;
+	const AutoFocus::Stats& stats = focusStats.current();
+	if (xtoon.state() == XToon::DEPTH || xtoon.state() == XToon::CPUDEPTH){
+		zmind = stats.zlow;
+		zmaxd = stats.zhigh;
+	}
+	else if (xtoon.state() == XToon::FOCUS || xtoon.state() == XToon::CPUFOCUS){
+		zmax = (stats.zhigh - stats.zlow) / 4;
+		zmin = 0.f;
+		zfoc = stats.zpoint;
+	}
+	else
+		return;
+	xtoon.refresh();
 }
 
 void reshape(int w, int h) {
@@ -137,6 +327,10 @@ void display () {
     glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     camera.apply (); 
     drawScene ();
+	if (autoFocus){
+		readDepthAsync();
+		refocusAuto();
+	}
     glFlush ();
     glutSwapBuffers (); 
 }
@@ -152,6 +346,47 @@ void key (unsigned char keyPressed, int x, int y) {
             fullScreen = true;
         }      
         break;
+	case 'a':
+		xtoon.approxMath(!xtoon.approxMath());
+		if (xtoon.approxMath())
+			cout << "** switched on approximate math.\n";
+		else
+			cout << "** switched off approximate math.\n";
+		break;
+	case 'b':
+		xtoon.bilinearSampling(!xtoon.bilinearSampling());
+		if (xtoon.bilinearSampling())
+			cout << "** switched on bilinear texture lookup.\n";
+		else
+			cout << "** switched off bilinear texture lookup.\n";
+		break;
+	case 'c':
+		cullMeshlets = !cullMeshlets;
+		if (cullMeshlets)
+			cout << "** switched on meshlet culling.\n";
+		else
+			cout << "** switched off meshlet culling.\n";
+		break;
+	case 'd':
+		useLOD = !useLOD;
+		if (useLOD)
+			cout << "** switched on levels of detail (" << lod.size() - 1 << " below the mesh).\n";
+		else
+			cout << "** switched off levels of detail.\n";
+		break;
+	case 'v':
+		depthStrategy = (DepthRange::Strategy)((depthStrategy + 1) % 3);
+		cout << "** refocusing on the " << DepthRange::name(depthStrategy) << " depth range.\n";
+		break;
+	case 'o':
+		autoFocus = !autoFocus;
+		depthReads = 0;
+		focusStats.reset();
+		if (autoFocus)
+			cout << "** switched on automatic refocusing.\n";
+		else
+			cout << "** switched off automatic refocusing.\n";
+		break;
 	case 'l':
 		camera.initPos();
 		changeLight = !changeLight;
@@ -171,30 +406,14 @@ void key (unsigned char keyPressed, int x, int y) {
         break;
 	case 'r':
 		if (xtoon.state() == XToon::DEPTH || xtoon.state() == XToon::CPUDEPTH){
-			float minz = farplane, maxz = nearplane;
-			for (unsigned int i = 0; i < mesh.T.size(); i++)
-				for (unsigned int j = 0; j < 3; j++) {
-					const Vertex & v = mesh.V[mesh.T[i].v[j]];
-					float z = camera.getZ(v.p);
-					if (z < minz)
-						minz = z;
-					if (z > maxz)
-						maxz = z;
-				}
+			float minz, maxz;
+			depthBounds(minz, maxz);
 			zmaxd = maxz;
 			zmind = minz;
 		}
 		else if (xtoon.state() == XToon::FOCUS || xtoon.state() == XToon::CPUFOCUS){
-			float minz = farplane, maxz = nearplane;
-			for (unsigned int i = 0; i < mesh.T.size(); i++)
-				for (unsigned int j = 0; j < 3; j++) {
-					const Vertex & v = mesh.V[mesh.T[i].v[j]];
-					float z = camera.getZ(v.p);
-					if (z < minz)
-						minz = z;
-					if (z > maxz)
-						maxz = z;
-				}
+			float minz, maxz;
+			depthBounds(minz, maxz);
 			zmax = (maxz - minz) / 4;
 			zmin = 0.f;
 			zfoc = (minz + maxz) / 2;
@@ -218,7 +437,12 @@ void key (unsigned char keyPressed, int x, int y) {
 }
 
 void mouse (int button, int state, int x, int y) {
-	if (changeLight){
+	if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN && (glutGetModifiers() & GLUT_ACTIVE_SHIFT)){
+		if (autoFocus)
+			focusStats.setPoint(x, y);
+		pickFocus(x, y);
+	}
+	else if (changeLight){
 		Vec3f p = light0.position;
 		int h = camera.getScreenHeight(),
 			w = camera.getScreenWidth();
@@ -259,16 +483,68 @@ void idle () {
     glutPostRedisplay (); 
 }
 
+//render one frame with the software rasterizer, no window nor OpenGL context;
+//with stream, the mesh is read chunk by chunk from its binary cache and never loaded
+int renderHeadless(const char * modelFilename, const char * imageFilename, unsigned int w, unsigned int h, bool stream) {
+	initXToon(false);
+	camera.setSize(w, h);
+	SoftRaster raster;
+	raster.resize(w, h);
+	raster.setClearColor(Vec3f(.8f, .8f, .8f));
+	if (stream) {
+		MeshStream meshStream;
+		string error;
+		if (!meshStream.open(modelFilename, &error, &ThreadPool::global())) {
+			cerr << "Error loading mesh: " << error << endl;
+			return 1;
+		}
+		raster.render(meshStream, camera, xtoon, &ThreadPool::global());
+	} else {
+		loadMesh(modelFilename);
+		meshlets.build(mesh);
+		raster.render(mesh, camera, xtoon, &ThreadPool::global(), &meshlets);
+	}
+	if (!raster.writeBMP(imageFilename)) {
+		cerr << "could not write " << imageFilename << endl;
+		return 1;
+	}
+	return 0;
+}
+
 int main (int argc, char ** argv) {
-	if (argc > 2) {
-        printUsage ();
-        exit (1);
-    }
+	const char * modelFilename = DEFAULT_MESH_FILE.c_str ();
+	const char * imageFilename = nullptr;
+	unsigned int imageWidth = DEFAULT_SCREENWIDTH, imageHeight = DEFAULT_SCREENHEIGHT;
+	int arg = 1;
+	if (arg < argc && string (argv[arg]) != "-o")
+		modelFilename = argv[arg++];
+	if (arg < argc) {
+		if (string (argv[arg]) != "-o" || arg + 1 >= argc) {
+			printUsage ();
+			exit (1);
+		}
+		imageFilename = argv[arg + 1];
+		arg += 2;
+		int end = argc;
+		bool stream = arg < end && string (argv[end - 1]) == "-stream";
+		if (stream)
+			end--;
+		if (arg + 2 == end) {
+			imageWidth = atoi (argv[arg]);
+			imageHeight = atoi (argv[arg + 1]);
+			arg += 2;
+		}
+		if (arg != end || imageWidth == 0 || imageHeight == 0) {
+			printUsage ();
+			exit (1);
+		}
+		return renderHeadless (modelFilename, imageFilename, imageWidth, imageHeight, stream);
+	}
     glutInit (&argc, argv);
     glutInitDisplayMode (GLUT_RGBA | GLUT_DEPTH | GLUT_DOUBLE);
     glutInitWindowSize (DEFAULT_SCREENWIDTH, DEFAULT_SCREENHEIGHT);
     window = glutCreateWindow (appTitle.c_str ());
-    init (argc == 2 ? argv[1] : DEFAULT_MESH_FILE.c_str ());
+    init (modelFilename);
     glutIdleFunc (idle);
     glutReshapeFunc (reshape);
     glutDisplayFunc (display);
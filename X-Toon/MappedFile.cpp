@@ -0,0 +1,104 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile () : _data (NULL), _size (0), _file (INVALID_HANDLE_VALUE), _mapping (NULL) {}
+
+bool MappedFile::open (const std::string & filename, std::string & error) {
+    close ();
+    _file = CreateFileA (filename.c_str (), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (_file == INVALID_HANDLE_VALUE) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx (_file, &size)) {
+        error = "cannot read the size of " + filename;
+        close ();
+        return false;
+    }
+    _size = (size_t)size.QuadPart;
+    if (_size == 0)
+        return true;
+    _mapping = CreateFileMappingA (_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping != NULL)
+        _data = (const char *)MapViewOfFile (_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (_data == NULL) {
+        error = "cannot map " + filename;
+        close ();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close () {
+    if (_data != NULL)
+        UnmapViewOfFile (_data);
+    if (_mapping != NULL)
+        CloseHandle (_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle (_file);
+    _data = NULL;
+    _size = 0;
+    _mapping = NULL;
+    _file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile () : _data (NULL), _size (0), _fd (-1) {}
+
+bool MappedFile::open (const std::string & filename, std::string & error) {
+    close ();
+    _fd = ::open (filename.c_str (), O_RDONLY);
+    struct stat st;
+    if (_fd < 0 || fstat (_fd, &st) != 0) {
+        error = "cannot open " + filename + ": " + strerror (errno);
+        close ();
+        return false;
+    }
+    _size = (size_t)st.st_size;
+    if (_size == 0)
+        return true;
+    void * p = mmap (NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (p == MAP_FAILED) {
+        error = "cannot map " + filename + ": " + strerror (errno);
+        close ();
+        return false;
+    }
+    _data = (const char *)p;
+    madvise (p, _size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::close () {
+    if (_data != NULL)
+        munmap ((void *)_data, _size);
+    if (_fd >= 0)
+        ::close (_fd);
+    _data = NULL;
+    _size = 0;
+    _fd = -1;
+}
+
+#endif
+
+MappedFile::~MappedFile () {
+    close ();
+}
@@ -0,0 +1,33 @@
+// --------------------------------------------------------------------------
+// Read-only memory-mapped file
+// --------------------------------------------------------------------------
+#pragma once
+#include <cstddef>
+#include <string>
+
+/// Maps a whole file read-only into memory (mmap, or a file mapping on Windows).
+/// The bytes are not null-terminated.
+class MappedFile {
+public:
+    MappedFile ();
+    ~MappedFile ();
+
+    /// Maps filename; on failure returns false and describes the problem in error.
+    bool open (const std::string & filename, std::string & error);
+    void close ();
+
+    inline const char * data () const { return _data; }
+    inline size_t size () const { return _size; }
+
+private:
+    const char * _data;
+    size_t _size;
+#ifdef _WIN32
+    void * _file;
+    void * _mapping;
+#else
+    int _fd;
+#endif
+    MappedFile (const MappedFile &);
+    MappedFile & operator= (const MappedFile &);
+};
@@ -16,49 +16,266 @@
 // for more details.                                                          
 // --------------------------------------------------------------------------
 
+#include "FPContract.h"
 #include "Mesh.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "MeshLOD.h"
+#include "ThreadPool.h"
+#include "FastMath.h"
+#include "OFFScanner.h"
+#include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <fstream>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 
 using namespace std;
 
-void Mesh::loadOFF (const std::string & filename) {
-	ifstream in (filename.c_str ());
-    if (!in) 
-        exit (1);
-	string offString;
-    unsigned int sizeV, sizeT, tmp;
-    in >> offString >> sizeV >> sizeT >> tmp;
-    V.resize (sizeV);
-    T.resize (sizeT);
-    for (unsigned int i = 0; i < sizeV; i++)
-        in >> V[i].p;
-    int s;
-    for (unsigned int i = 0; i < sizeT; i++) {
-        in >> s;
-        for (unsigned int j = 0; j < 3; j++)
-            in >> T[i].v[j];
+namespace {
+
+    /// Element lines are the lines holding a token, blank and comment-only lines are not.
+    inline bool isElementLine (const char * line, const char * lineEnd) {
+        while (line < lineEnd && OFFScanner::isSpace (*line))
+            line++;
+        return line < lineEnd && *line != '#';
+    }
+
+    inline const char * lineEnd (const char * line, const char * end) {
+        const char * e = (const char *)memchr (line, '\n', end - line);
+        return e == NULL ? end : e;
+    }
+
+    unsigned int countElementLines (const char * begin, const char * end) {
+        unsigned int n = 0;
+        for (const char * line = begin; line < end; ) {
+            const char * e = lineEnd (line, end);
+            n += isElementLine (line, e);
+            line = e + 1;
+        }
+        return n;
     }
-    in.close ();
+
+    /// Parses the element lines of [begin, end), the first one being element number first
+    /// (vertices then faces). Any element the line-based reading cannot take makes it fail.
+    bool parseElementLines (const char * begin, const char * end, unsigned int first, Mesh & mesh) {
+        unsigned int sizeV = (unsigned int)mesh.V.size (), sizeT = (unsigned int)mesh.T.size ();
+        unsigned int k = first;
+        for (const char * line = begin; line < end && k < sizeV + sizeT; ) {
+            const char * e = lineEnd (line, end);
+            if (isElementLine (line, e)) {
+                OFFScanner in (line, e);
+                if (k < sizeV) {
+                    Vec3f & p = mesh.V[k].p;
+                    if (!in.parseFloat (p[0]) || !in.parseFloat (p[1]) || !in.parseFloat (p[2]))
+                        return false;
+                } else {
+                    unsigned int n;
+                    unsigned int * v = mesh.T[k - sizeV].v;
+                    if (!in.parseUInt (n) || n != 3 || !in.parseUInt (v[0]) || !in.parseUInt (v[1]) || !in.parseUInt (v[2])
+                        || v[0] >= sizeV || v[1] >= sizeV || v[2] >= sizeV)
+                        return false;
+                }
+                k++;
+            }
+            line = e + 1;
+        }
+        return true;
+    }
+
+    /// Parallel reading of the vertices and faces in [begin, end), one element per line: the body is
+    /// cut into chunks on line boundaries, the element lines of every chunk are counted, and a prefix
+    /// sum gives each chunk the index of its first element, so the chunks then fill their own slots of
+    /// the preallocated V and T. Returns false on anything unexpected (a malformed or split element,
+    /// missing elements...), the sequential reading then gives the same mesh or the error message.
+    bool parseBodyParallel (const char * begin, const char * end, Mesh & mesh, ThreadPool & pool) {
+        const size_t CHUNK = 1 << 20;
+        std::vector<const char *> cuts (1, begin);
+        while ((size_t)(end - cuts.back ()) > CHUNK) {
+            const char * c = cuts.back () + CHUNK;
+            c = (const char *)memchr (c, '\n', end - c);
+            if (c == NULL)
+                break;
+            cuts.push_back (c + 1);
+        }
+        cuts.push_back (end);
+        unsigned int numChunks = (unsigned int)cuts.size () - 1;
+        std::vector<unsigned int> first (numChunks + 1, 0);
+        pool.parallelFor (numChunks, 1, [&] (unsigned int b, unsigned int e) {
+            for (unsigned int c = b; c < e; c++)
+                first[c + 1] = countElementLines (cuts[c], cuts[c + 1]);
+        });
+        for (unsigned int c = 0; c < numChunks; c++)
+            first[c + 1] += first[c];
+        if (first[numChunks] < mesh.V.size () + mesh.T.size ())
+            return false;
+        std::atomic<bool> ok (true);
+        pool.parallelFor (numChunks, 1, [&] (unsigned int b, unsigned int e) {
+            for (unsigned int c = b; c < e && ok; c++)
+                if (!parseElementLines (cuts[c], cuts[c + 1], first[c], mesh))
+                    ok = false;
+        });
+        return ok;
+    }
+
+    const unsigned int NORMAL_GRAIN = 4096;
+
+    /// Normals of triangles [begin, end), vfloat::width triangles at a time: the edge vectors are
+    /// gathered into lanes, crossed and (but for AREA) normalized as Vec3f does it, so the UNIFORM
+    /// normals are the same as the scalar ones. For ANGLE the angle at every corner is also stored,
+    /// atan2 (2 * area, dot of the corner edges) from the same lanes.
+    void computeFaceNormals (const Mesh & mesh, unsigned int begin, unsigned int end,
+                             Mesh::NormalWeights weights, float * normals, float * angles) {
+        const int W = vfloat::width;
+        for (unsigned int t0 = begin; t0 < end; t0 += W) {
+            unsigned int count = std::min (end - t0, (unsigned int)W);
+            alignas(32) float e[6][W];
+            for (unsigned int k = 0; k < (unsigned int)W; k++) {
+                unsigned int t = t0 + std::min (k, count - 1);
+                const Vec3f & p0 = mesh.V[mesh.T[t].v[0]].p;
+                Vec3f e01 = mesh.V[mesh.T[t].v[1]].p - p0;
+                Vec3f e02 = mesh.V[mesh.T[t].v[2]].p - p0;
+                for (unsigned int j = 0; j < 3; j++) {
+                    e[j][k] = e01[j];
+                    e[3 + j][k] = e02[j];
+                }
+            }
+            vfloat3 e01 (vfloat::load (e[0]), vfloat::load (e[1]), vfloat::load (e[2]));
+            vfloat3 e02 (vfloat::load (e[3]), vfloat::load (e[4]), vfloat::load (e[5]));
+            vfloat3 n = cross (e01, e02);
+            alignas(32) float a[3][W];
+            if (angles != NULL) {
+                vfloat twiceArea = length (n);
+                vfloat3 e12 = e02 - e01;
+                fastAtan2 (twiceArea, dot (e01, e02)).store (a[0]);
+                fastAtan2 (twiceArea, vfloat (0.f) - dot (e12, e01)).store (a[1]);
+                fastAtan2 (twiceArea, dot (e12, e02)).store (a[2]);
+            }
+            if (weights != Mesh::AREA)
+                n = normalize (n);
+            alignas(32) float nx[W], ny[W], nz[W];
+            n.x.store (nx);
+            n.y.store (ny);
+            n.z.store (nz);
+            for (unsigned int k = 0; k < count; k++) {
+                unsigned int t = t0 + k;
+                normals[3 * t] = nx[k];
+                normals[3 * t + 1] = ny[k];
+                normals[3 * t + 2] = nz[k];
+                if (angles != NULL)
+                    for (unsigned int j = 0; j < 3; j++)
+                        angles[3 * t + j] = a[j][k];
+            }
+        }
+    }
+
+    /// OFF header, vertices then triangle faces.
+    bool parseOFF (const char * data, size_t size, const std::string & filename, Mesh & mesh, std::string & error, ThreadPool * pool) {
+        OFFScanner in (data, data + size);
+        unsigned int sizeV, sizeT;
+        std::string what;
+        if (!in.parseHeader (sizeV, sizeT, what)) {
+            error = filename + ":" + what;
+            return false;
+        }
+        mesh.V.resize (sizeV);
+        mesh.T.resize (sizeT);
+        if (pool != NULL && pool->size () > 1 && parseBodyParallel (in.position (), data + size, mesh, *pool))
+            return true;
+        for (unsigned int i = 0; i < sizeV; i++)
+            if (!in.parseVertex (i, &mesh.V[i].p[0], what)) {
+                error = filename + ":" + what;
+                return false;
+            }
+        for (unsigned int i = 0; i < sizeT; i++)
+            if (!in.parseTriangle (i, sizeV, mesh.T[i].v, what)) {
+                error = filename + ":" + what;
+                return false;
+            }
+        return true;
+    }
+}
+
+bool Mesh::loadOFF (const std::string & filename, std::string * error, ThreadPool * pool) {
+    MappedFile file;
+    std::string message;
+    adjacencyStart.clear ();
+    adjacentCorners.clear ();
+    if (!file.open (filename, message) || !parseOFF (file.data (), file.size (), filename, *this, message, pool)) {
+        V.clear ();
+        T.clear ();
+        if (error != NULL)
+            *error = message;
+        return false;
+    }
+    file.close ();
     centerAndScaleToUnit ();
-    recomputeNormals ();
+    recomputeNormals (UNIFORM, pool);
+    computeBoundingSphere ();
+    return true;
 }
 
-void Mesh::recomputeNormals () {
-    for (unsigned int i = 0; i < V.size (); i++)
-        V[i].n = Vec3f (0.0, 0.0, 0.0);
-    for (unsigned int i = 0; i < T.size (); i++) {
-        Vec3f e01 = V[T[i].v[1]].p -  V[T[i].v[0]].p;
-        Vec3f e02 = V[T[i].v[2]].p -  V[T[i].v[0]].p;
-        Vec3f n = cross (e01, e02);
-        n.normalize ();
+bool Mesh::load (const std::string & filename, std::string * error, ThreadPool * pool, bool optimize, MeshLOD * lod) {
+    MeshCache cache;
+    std::string cacheFilename = MeshCache::filenameFor (filename), message;
+    if (cache.open (cacheFilename, filename, message)
+        && (!optimize || (cache.header ().flags & MeshCache::OPTIMIZED) != 0)
+        && (lod == NULL || (cache.header ().flags & MeshCache::LODS) != 0)
+        && cache.copyTo (*this, pool) && (lod == NULL || cache.copyTo (*lod)))
+        return true;
+    cache.close ();
+    if (!loadOFF (filename, error, pool))
+        return false;
+    if (optimize)
+        optimizeLocality ();
+    if (lod != NULL)
+        lod->build (*this, 0.25f, 4096, pool);
+    MeshCache::write (cacheFilename, filename, *this, optimize ? MeshCache::OPTIMIZED : 0, message, lod);
+    return true;
+}
+
+void Mesh::buildAdjacency () {
+    adjacencyStart.assign (V.size () + 1, 0);
+    for (unsigned int i = 0; i < T.size (); i++)
         for (unsigned int j = 0; j < 3; j++)
-            V[T[i].v[j]].n += n;
-    }
+            adjacencyStart[T[i].v[j] + 1]++;
     for (unsigned int i = 0; i < V.size (); i++)
-        V[i].n.normalize ();
+        adjacencyStart[i + 1] += adjacencyStart[i];
+    adjacentCorners.resize (3 * T.size ());
+    std::vector<unsigned int> next (adjacencyStart.begin (), adjacencyStart.end () - 1);
+    for (unsigned int i = 0; i < T.size (); i++)
+        for (unsigned int j = 0; j < 3; j++)
+            adjacentCorners[next[T[i].v[j]]++] = 3 * i + j;
+}
+
+void Mesh::recomputeNormals (NormalWeights weights, ThreadPool * pool) {
+    if (adjacencyStart.size () != V.size () + 1 || adjacentCorners.size () != 3 * T.size ())
+        buildAdjacency ();
+    faceNormals.resize (3 * T.size ());
+    if (weights == ANGLE)
+        cornerAngles.resize (3 * T.size ());
+    forChunks (pool, (unsigned int)T.size (), NORMAL_GRAIN, [&] (unsigned int begin, unsigned int end) {
+        computeFaceNormals (*this, begin, end, weights, faceNormals.data (), weights == ANGLE ? cornerAngles.data () : NULL);
+    });
+    forChunks (pool, (unsigned int)V.size (), NORMAL_GRAIN, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            Vec3f n;
+            if (weights == ANGLE)
+                for (unsigned int k = adjacencyStart[i]; k < adjacencyStart[i + 1]; k++) {
+                    unsigned int c = adjacentCorners[k];
+                    const float * fn = &faceNormals[3 * (c / 3)];
+                    n += Vec3f (fn[0] * cornerAngles[c], fn[1] * cornerAngles[c], fn[2] * cornerAngles[c]);
+                }
+            else
+                for (unsigned int k = adjacencyStart[i]; k < adjacencyStart[i + 1]; k++) {
+                    const float * fn = &faceNormals[3 * (adjacentCorners[k] / 3)];
+                    n += Vec3f (fn[0], fn[1], fn[2]);
+                }
+            n.normalize ();
+            V[i].n = n;
+        }
+    });
 }
 
 void Mesh::centerAndScaleToUnit () {
@@ -75,3 +292,129 @@ void Mesh::centerAndScaleToUnit () {
     for  (unsigned int i = 0; i < V.size (); i++)
         V[i].p = (V[i].p - c) / maxD;
 }
+
+void Mesh::computeBoundingSphere () {
+    center = Vec3f ();
+    for (unsigned int i = 0; i < V.size (); i++)
+        center += V[i].p;
+    if (!V.empty ())
+        center /= V.size ();
+    radius = 0.f;
+    for (unsigned int i = 0; i < V.size (); i++)
+        radius = std::max (radius, dist (V[i].p, center));
+}
+
+float Mesh::acmr (unsigned int cacheSize) const {
+    if (T.empty ())
+        return 0.f;
+    //FIFO: a vertex is cached while fewer than cacheSize misses followed its own
+    std::vector<unsigned int> missTime (V.size (), 0);
+    unsigned int misses = 0;
+    for (unsigned int i = 0; i < T.size (); i++)
+        for (unsigned int j = 0; j < 3; j++) {
+            unsigned int v = T[i].v[j];
+            if (missTime[v] == 0 || misses - missTime[v] >= cacheSize)
+                missTime[v] = ++misses;
+        }
+    return (float)misses / T.size ();
+}
+
+Mesh::LocalityStats Mesh::optimizeLocality (unsigned int cacheSize) {
+    LocalityStats stats;
+    stats.acmrBefore = acmr (cacheSize);
+    buildAdjacency ();
+
+    //Tipsify: fan around the current vertex, emitting its live triangles, then move to the
+    //candidate still in cache with the most live triangles, or back to a dead-end vertex
+    unsigned int numV = (unsigned int)V.size (), numT = (unsigned int)T.size ();
+    std::vector<unsigned int> live (numV), cacheTime (numV, 0), deadEnd, candidates;
+    for (unsigned int v = 0; v < numV; v++)
+        live[v] = adjacencyStart[v + 1] - adjacencyStart[v];
+    std::vector<bool> emitted (numT, false);
+    std::vector<Triangle> order;
+    order.reserve (numT);
+    unsigned int time = cacheSize + 1, cursor = 0;
+    int fan = numV > 0 ? 0 : -1;
+    while (fan >= 0) {
+        candidates.clear ();
+        for (unsigned int k = adjacencyStart[fan]; k < adjacencyStart[fan + 1]; k++) {
+            unsigned int t = adjacentCorners[k] / 3;
+            if (emitted[t])
+                continue;
+            for (unsigned int j = 0; j < 3; j++) {
+                unsigned int v = T[t].v[j];
+                deadEnd.push_back (v);
+                candidates.push_back (v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+            order.push_back (T[t]);
+        }
+        int next = -1, best = -1;
+        for (unsigned int c = 0; c < candidates.size (); c++) {
+            unsigned int v = candidates[c];
+            if (live[v] == 0)
+                continue;
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        while (next < 0 && !deadEnd.empty ()) {
+            unsigned int d = deadEnd.back ();
+            deadEnd.pop_back ();
+            if (live[d] > 0)
+                next = d;
+        }
+        while (next < 0 && cursor < numV) {
+            if (live[cursor] > 0)
+                next = cursor;
+            cursor++;
+        }
+        fan = next;
+    }
+    T.swap (order);
+
+    //vertices in order of first use
+    const unsigned int UNUSED = 0xffffffff;
+    std::vector<unsigned int> remap (numV, UNUSED);
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < numT; i++)
+        for (unsigned int j = 0; j < 3; j++) {
+            unsigned int & v = T[i].v[j];
+            if (remap[v] == UNUSED)
+                remap[v] = next++;
+            v = remap[v];
+        }
+    for (unsigned int v = 0; v < numV; v++)
+        if (remap[v] == UNUSED)
+            remap[v] = next++;
+    std::vector<Vertex> reordered (numV);
+    for (unsigned int v = 0; v < numV; v++)
+        reordered[remap[v]] = V[v];
+    V.swap (reordered);
+
+    adjacencyStart.clear ();
+    adjacentCorners.clear ();
+    stats.acmrAfter = acmr (cacheSize);
+    return stats;
+}
+
+void VertexArrays::build (const std::vector<Vertex> & V) {
+    px.resize (V.size ()); py.resize (V.size ()); pz.resize (V.size ());
+    nx.resize (V.size ()); ny.resize (V.size ()); nz.resize (V.size ());
+    for (unsigned int i = 0; i < V.size (); i++) {
+        px[i] = V[i].p[0]; py[i] = V[i].p[1]; pz[i] = V[i].p[2];
+        nx[i] = V[i].n[0]; ny[i] = V[i].n[1]; nz[i] = V[i].n[2];
+    }
+}
+
+void VertexArrays::resize (unsigned int n) {
+    px.resize (n); py.resize (n); pz.resize (n);
+    nx.resize (n); ny.resize (n); nz.resize (n);
+}
@@ -18,15 +18,19 @@
 
 #pragma once
 #include <cmath>
+#include <string>
+#include <type_traits>
 #include <vector>
 #include "Vec3.h"
 
+class ThreadPool;
+class MeshLOD;
+
 /// A simple vertex class storing position and normal
 class Vertex {
 public:
     inline Vertex () {}
 	inline Vertex(const Vec3f & p, const Vec3f & n) : p(p), n(n) {}
-    inline virtual ~Vertex () {}
 	Vec3f p;
 	Vec3f n;
 };
@@ -37,38 +41,97 @@ public:
     inline Triangle () {
         v[0] = v[1] = v[2] = 0;
     }
-    inline Triangle (const Triangle & t) {
-        v[0] = t.v[0];
-        v[1] = t.v[1];
-        v[2] = t.v[2];
-    }
     inline Triangle (unsigned int v0, unsigned int v1, unsigned int v2) {
         v[0] = v0;
         v[1] = v1;
         v[2] = v2;
     }
-    inline virtual ~Triangle () {}
-    inline Triangle & operator= (const Triangle & t) {
-        v[0] = t.v[0];
-        v[1] = t.v[1];
-        v[2] = t.v[2];
-        return (*this);
-    }
     unsigned int v[3];
 };
 
+// Vertex and Triangle arrays are plain packed data (no vtable pointer): they can be
+// memcpy'd, and uploaded or written to disk as they are.
+static_assert (std::is_trivially_copyable<Vertex>::value && sizeof (Vertex) == 24, "Vertex must be 6 packed floats");
+static_assert (std::is_trivially_copyable<Triangle>::value && sizeof (Triangle) == 12, "Triangle must be 3 packed indices");
+
+/// Structure-of-arrays copy of a vertex list, the input layout of XToon::getBatch
+class VertexArrays {
+public:
+    std::vector<float> px, py, pz;
+    std::vector<float> nx, ny, nz;
+
+    void build (const std::vector<Vertex> & V);
+    void resize (unsigned int n);
+    inline unsigned int size () const { return px.size (); }
+};
+
 /// A Mesh class, storing a list of vertices and a list of triangles indexed over it.
 class Mesh {
 public:
+    /// Weighting of the face normals summed into a vertex normal
+    enum NormalWeights { UNIFORM, AREA, ANGLE };
+
 	std::vector<Vertex> V;
 	std::vector<Triangle> T;
+    /// Bounding sphere of the positions (centroid and farthest vertex), set by the loaders
+    Vec3f center;
+    float radius;
 
-    /// Loads the mesh from a <file>.off
-	void loadOFF (const std::string & filename);
+    inline Mesh () : radius (0.f) {}
+
+    /// Loads filename through its binary cache (see MeshCache): the cache is read if it is
+    /// up to date, otherwise the mesh is loaded with loadOFF and the cache (re)written.
+    /// Failing to write the cache is not an error. With optimize, the mesh is reordered by
+    /// optimizeLocality before being cached, so the reordering is paid once; with lod, its
+    /// levels of detail are built (MeshLOD::build, which reorders V) and cached as well.
+    bool load (const std::string & filename, std::string * error = NULL, ThreadPool * pool = NULL,
+               bool optimize = false, MeshLOD * lod = NULL);
+
+    /// Loads the mesh from a <file>.off (triangle faces only), then centers, scales and
+    /// computes the normals. Returns false and leaves the mesh empty if the file cannot
+    /// be read or is malformed, error (if given) then tells why and where.
+    /// With a pool, files with one vertex or face per line are parsed in parallel chunks,
+    /// with the same result as the sequential parse.
+	bool loadOFF (const std::string & filename, std::string * error = NULL, ThreadPool * pool = NULL);
     
-    /// Compute smooth per-vertex normals
-    void recomputeNormals ();
+    /// Compute smooth per-vertex normals, the face normals being weighted equally (UNIFORM),
+    /// by the face area (AREA) or by the face angle at the vertex (ANGLE).
+    /// Face normals are computed first, then each vertex gathers the normals of its faces
+    /// through the adjacency, in triangle order, so chunks of faces and of vertices run in
+    /// parallel on the pool without sharing any write.
+    void recomputeNormals (NormalWeights weights = UNIFORM, ThreadPool * pool = NULL);
+
+    /// Vertex to triangle adjacency (CSR): the corners around vertex i are
+    /// adjacentCorners[adjacencyStart[i] .. adjacencyStart[i + 1]), stored as 3 * triangle + corner
+    /// in increasing order. Built by recomputeNormals when the sizes do not match V and T;
+    /// cleared by everything here that replaces V or T (loadOFF, MeshCache::copyTo,
+    /// MeshStream::read, optimizeLocality, MeshLOD::build); call it
+    /// again after changing T yourself without changing its size.
+    void buildAdjacency ();
+    std::vector<unsigned int> adjacencyStart;
+    std::vector<unsigned int> adjacentCorners;
 
     /// scale to the unit cube and center at original
     void centerAndScaleToUnit ();
+
+    /// Sets center and radius from the positions
+    void computeBoundingSphere ();
+
+    /// Average cache miss ratio of T: vertices transformed per triangle with a FIFO
+    /// post-transform cache of cacheSize entries (3 at worst, about 0.6 at best).
+    float acmr (unsigned int cacheSize = 16) const;
+
+    struct LocalityStats {
+        float acmrBefore;
+        float acmrAfter;
+    };
+
+    /// Reorders T for the post-transform vertex cache (Tipsify, Sander et al. 2007), then V
+    /// in order of first use by the new T, unused vertices last. The surface is unchanged;
+    /// the GPU cache and the CPU loops over V and T both get better locality.
+    LocalityStats optimizeLocality (unsigned int cacheSize = 16);
+
+private:
+    std::vector<float> faceNormals;     ///< 3 per triangle, weighted as asked
+    std::vector<float> cornerAngles;    ///< 3 per triangle, for ANGLE
 };
@@ -0,0 +1,512 @@
+#include "FPContract.h"
+#include "MeshCache.h"
+#include "Mesh.h"
+#include "MeshLOD.h"
+#include "ThreadPool.h"
+#include "OFFScanner.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+    const char MAGIC[8] = { 'X', 'T', 'O', 'O', 'N', 'M', 'C', '\0' };
+    const unsigned int GRAIN = 1 << 16;
+
+    inline uint64_t align64 (uint64_t offset) { return (offset + 63) & ~(uint64_t)63; }
+
+    /// Size and modification time of a file, the time in nanoseconds so that an edit within
+    /// the second of the previous one still changes it where the file system keeps that much.
+    bool stamp (const std::string & filename, uint64_t & size, int64_t & time) {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesExA (filename.c_str (), GetFileExInfoStandard, &attributes))
+            return false;
+        size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        // 100 ns ticks since 1601
+        time = (int64_t)((((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32)
+                          | attributes.ftLastWriteTime.dwLowDateTime) * 100);
+#else
+        struct stat st;
+        if (stat (filename.c_str (), &st) != 0)
+            return false;
+        size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+        time = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        time = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+        return true;
+    }
+
+    /// Name of a temporary file next to filename, with the id of the process so that two
+    /// runs writing the same cache do not write into each other's.
+    std::string temporaryName (const std::string & filename, const char * suffix) {
+#ifdef _WIN32
+        return filename + "." + to_string (_getpid ()) + suffix;
+#else
+        return filename + "." + to_string (getpid ()) + suffix;
+#endif
+    }
+
+    const unsigned int CONVERT_CHUNK = 1 << 20;     ///< vertices or triangles per buffer of convert
+    const unsigned int NORMAL_RANGE = 1 << 21;      ///< vertex normals gathered per scan of the indices
+
+    bool seek (FILE * file, uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64 (file, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko (file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    /// Writes time over the source time in the header of the cache filename.
+    bool restamp (const std::string & filename, int64_t time) {
+        FILE * file = fopen (filename.c_str (), "r+b");
+        if (file == NULL)
+            return false;
+        bool written = seek (file, offsetof (MeshCache::Header, sourceTime))
+            && fwrite (&time, sizeof (time), 1, file) == 1;
+        return fclose (file) == 0 && written;
+    }
+
+    /// Reads the vertices [0, count) stored at offset a chunk at a time, and writes each chunk
+    /// back when fn (chunk, size) tells that it changed it.
+    template <class Func>
+    bool forVertexChunks (FILE * file, uint64_t offset, unsigned int count, std::vector<Vec3f> & buffer, const Func & fn) {
+        for (unsigned int begin = 0; begin < count; begin += CONVERT_CHUNK) {
+            size_t n = min (count - begin, CONVERT_CHUNK);
+            uint64_t at = offset + sizeof (Vec3f) * (uint64_t)begin;
+            if (!seek (file, at) || fread (&buffer[0], sizeof (Vec3f), n, file) != n)
+                return false;
+            if (!fn (&buffer[0], n))
+                continue;
+            if (!seek (file, at) || fwrite (&buffer[0], sizeof (Vec3f), n, file) != n)
+                return false;
+        }
+        return true;
+    }
+}
+
+MeshCache::MeshCache () : _header (NULL) {}
+
+std::string MeshCache::filenameFor (const std::string & source) {
+    return source + ".xtc";
+}
+
+uint64_t MeshCache::hash (const char * data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy (&w, data + i, 8);
+        h = (h ^ w) * 0x100000001b3ull;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++)
+        h = (h ^ (unsigned char)data[i]) * 0x100000001b3ull;
+    return h ^ size;
+}
+
+bool MeshCache::open (const std::string & filename, const std::string & source, std::string & error) {
+    close ();
+    if (!_file.open (filename, error))
+        return false;
+    const Header * h = (const Header *)_file.data ();
+    uint64_t size = _file.size ();
+    if (size < sizeof (Header) || memcmp (h->magic, MAGIC, sizeof (MAGIC)) != 0 || h->headerSize != sizeof (Header)) {
+        error = filename + " is not a mesh cache of this build";
+        close ();
+        return false;
+    }
+    if (h->version != VERSION) {
+        error = filename + " has version " + to_string (h->version) + ", expected " + to_string (VERSION);
+        close ();
+        return false;
+    }
+    uint64_t vertexBytes = 12ull * h->numVertices, triangleBytes = 12ull * h->numTriangles;
+    if (h->fileSize != size || h->numVertices == 0
+        || h->positions % 64 != 0 || h->normals % 64 != 0 || h->indices % 64 != 0
+        || h->positions < sizeof (Header) || h->positions + vertexBytes > size
+        || h->normals + vertexBytes > size || h->indices + triangleBytes > size
+        || ((h->flags & LODS) != 0 && (h->levels % 64 != 0 || h->levels + sizeof (Level) * (uint64_t)h->numLevels > size))) {
+        error = filename + " is truncated or corrupted";
+        close ();
+        return false;
+    }
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!stamp (source, sourceSize, sourceTime) || sourceSize != h->sourceSize) {
+        error = filename + " is out of date";
+        close ();
+        return false;
+    }
+    if (sourceTime != h->sourceTime) {
+        MappedFile sourceFile;
+        if (!sourceFile.open (source, error) || hash (sourceFile.data (), sourceFile.size ()) != h->sourceHash) {
+            error = filename + " is out of date";
+            close ();
+            return false;
+        }
+        // same content: take the new time so that the next open does not hash again. The
+        // mapping is closed first, Windows refusing to write a mapped file; a cache that
+        // cannot be written (read-only media) stays valid, only hashed on every open
+        _file.close ();
+        restamp (filename, sourceTime);
+        if (!_file.open (filename, error))
+            return false;
+        h = (const Header *)_file.data ();
+        if (_file.size () != size) {
+            error = filename + " changed while opened";
+            close ();
+            return false;
+        }
+    }
+    _header = h;
+    return true;
+}
+
+void MeshCache::close () {
+    _file.close ();
+    _header = NULL;
+}
+
+bool MeshCache::copyTo (Mesh & mesh, ThreadPool * pool) const {
+    const Header & h = header ();
+    const float * p = positions ();
+    const float * n = normals ();
+    const uint32_t * t = indices ();
+    mesh.V.resize (h.numVertices);
+    mesh.T.resize (h.numTriangles);
+    mesh.adjacencyStart.clear ();
+    mesh.adjacentCorners.clear ();
+    forChunks (pool, h.numVertices, GRAIN, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            memcpy ((void *)&mesh.V[i].p, p + 3 * i, sizeof (Vec3f));
+            memcpy ((void *)&mesh.V[i].n, n + 3 * i, sizeof (Vec3f));
+        }
+    });
+    std::atomic<bool> inRange (true);
+    forChunks (pool, h.numTriangles, GRAIN, [&] (unsigned int begin, unsigned int end) {
+        memcpy ((void *)&mesh.T[begin], t + 3 * begin, sizeof (Triangle) * (end - begin));
+        uint32_t maxIndex = 0;
+        for (unsigned int i = 3 * begin; i < 3 * end; i++)
+            maxIndex = max (maxIndex, t[i]);
+        if (maxIndex >= h.numVertices)
+            inRange = false;
+    });
+    mesh.center = Vec3f (h.center[0], h.center[1], h.center[2]);
+    mesh.radius = h.radius;
+    return inRange;
+}
+
+bool MeshCache::copyTo (MeshLOD & lod) const {
+    const Header & h = header ();
+    lod.clear ();
+    if ((h.flags & LODS) == 0)
+        return true;
+    const Level * table = (const Level *)(_file.data () + h.levels);
+    lod.levels.resize (h.numLevels);
+    for (unsigned int l = 0; l < h.numLevels; l++) {
+        const Level & level = table[l];
+        LODLevel & out = lod.levels[l];
+        if (level.numVertices > h.numVertices || level.indices % 64 != 0
+            || level.indices + 12ull * level.numTriangles > _file.size ()) {
+            lod.clear ();
+            return false;
+        }
+        out.numVertices = level.numVertices;
+        out.error = level.error;
+        out.T.resize (level.numTriangles);
+        memcpy ((void *)out.T.data (), _file.data () + level.indices, sizeof (Triangle) * level.numTriangles);
+        for (unsigned int i = 0; i < level.numTriangles; i++)
+            if (out.T[i].v[0] >= level.numVertices || out.T[i].v[1] >= level.numVertices || out.T[i].v[2] >= level.numVertices) {
+                lod.clear ();
+                return false;
+            }
+    }
+    return true;
+}
+
+/// Header of a cache of source, without the mesh: version, stamp and hash of the source.
+bool MeshCache::startHeader (Header & h, const std::string & source, std::string & error) {
+    memset (&h, 0, sizeof (Header));
+    memcpy (h.magic, MAGIC, sizeof (MAGIC));
+    h.version = VERSION;
+    h.headerSize = sizeof (Header);
+    MappedFile sourceFile;
+    if (!stamp (source, h.sourceSize, h.sourceTime) || !sourceFile.open (source, error)) {
+        error = "cannot read " + source;
+        return false;
+    }
+    h.sourceHash = hash (sourceFile.data (), sourceFile.size ());
+    return true;
+}
+
+bool MeshCache::write (const std::string & filename, const std::string & source, const Mesh & mesh, uint32_t flags,
+                       std::string & error, const MeshLOD * lod) {
+    Header h;
+    if (!startHeader (h, source, error))
+        return false;
+    h.numVertices = (uint32_t)mesh.V.size ();
+    h.numTriangles = (uint32_t)mesh.T.size ();
+    h.flags = lod != NULL ? flags | LODS : flags & ~(uint32_t)LODS;
+    h.acmr = mesh.acmr ();
+    for (unsigned int k = 0; k < 3; k++)
+        h.center[k] = mesh.center[k];
+    h.radius = mesh.radius;
+    h.positions = align64 (sizeof (Header));
+    h.normals = align64 (h.positions + 12ull * h.numVertices);
+    h.indices = align64 (h.normals + 12ull * h.numVertices);
+    h.fileSize = h.indices + 12ull * h.numTriangles;
+    std::vector<Level> levels;
+    if (lod != NULL) {
+        h.numLevels = (uint32_t)lod->levels.size ();
+        h.levels = align64 (h.fileSize);
+        h.fileSize = h.levels + sizeof (Level) * h.numLevels;
+        levels.resize (h.numLevels);
+        for (unsigned int l = 0; l < h.numLevels; l++) {
+            Level & level = levels[l];
+            memset (&level, 0, sizeof (Level));
+            level.numVertices = lod->levels[l].numVertices;
+            level.numTriangles = (uint32_t)lod->levels[l].T.size ();
+            level.error = lod->levels[l].error;
+            level.indices = align64 (h.fileSize);
+            h.fileSize = level.indices + 12ull * level.numTriangles;
+        }
+    }
+
+    // positions and normals as two packed arrays, the layout of the file
+    std::vector<Vec3f> positions (mesh.V.size ()), normals (mesh.V.size ());
+    for (unsigned int i = 0; i < mesh.V.size (); i++) {
+        positions[i] = mesh.V[i].p;
+        normals[i] = mesh.V[i].n;
+    }
+
+    std::string temporary = temporaryName (filename, ".tmp");
+    ofstream out (temporary.c_str (), ios::binary);
+    if (!out) {
+        error = "cannot write " + temporary;
+        return false;
+    }
+    const char zeros[64] = { 0 };
+    out.write ((const char *)&h, sizeof (Header));
+    out.write (zeros, h.positions - sizeof (Header));
+    out.write ((const char *)positions.data (), sizeof (Vec3f) * positions.size ());
+    out.write (zeros, h.normals - h.positions - sizeof (Vec3f) * positions.size ());
+    out.write ((const char *)normals.data (), sizeof (Vec3f) * normals.size ());
+    out.write (zeros, h.indices - h.normals - sizeof (Vec3f) * normals.size ());
+    out.write ((const char *)mesh.T.data (), sizeof (Triangle) * mesh.T.size ());
+    if (lod != NULL) {
+        uint64_t position = h.indices + sizeof (Triangle) * mesh.T.size ();
+        out.write (zeros, h.levels - position);
+        out.write ((const char *)levels.data (), sizeof (Level) * levels.size ());
+        position = h.levels + sizeof (Level) * levels.size ();
+        for (unsigned int l = 0; l < levels.size (); l++) {
+            out.write (zeros, levels[l].indices - position);
+            out.write ((const char *)lod->levels[l].T.data (), sizeof (Triangle) * lod->levels[l].T.size ());
+            position = levels[l].indices + sizeof (Triangle) * lod->levels[l].T.size ();
+        }
+    }
+    out.close ();
+    if (!out) {
+        error = "cannot write " + temporary;
+        remove (temporary.c_str ());
+        return false;
+    }
+    remove (filename.c_str ());
+    if (rename (temporary.c_str (), filename.c_str ()) != 0) {
+        error = "cannot rename " + temporary + " to " + filename;
+        remove (temporary.c_str ());
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::convert (const std::string & filename, const std::string & source, std::string & error) {
+    Header h;
+    MappedFile sourceFile;
+    if (!startHeader (h, source, error) || !sourceFile.open (source, error))
+        return false;
+    OFFScanner in (sourceFile.data (), sourceFile.data () + sourceFile.size ());
+    unsigned int sizeV, sizeT;
+    std::string what;
+    if (!in.parseHeader (sizeV, sizeT, what)) {
+        error = source + ":" + what;
+        return false;
+    }
+    h.numVertices = sizeV;
+    h.numTriangles = sizeT;
+    h.positions = align64 (sizeof (Header));
+    h.normals = align64 (h.positions + 12ull * h.numVertices);
+    h.indices = align64 (h.normals + 12ull * h.numVertices);
+    h.fileSize = h.indices + 12ull * h.numTriangles;
+
+    std::string temporary = temporaryName (filename, ".tmp"), normalsTemporary = temporaryName (filename, ".normals.tmp");
+    FILE * out = fopen (temporary.c_str (), "w+b");
+    if (out == NULL) {
+        error = "cannot write " + temporary;
+        return false;
+    }
+    std::vector<Vec3f> vertices (min (sizeV, CONVERT_CHUNK));
+    std::vector<Triangle> triangles (min (max (sizeT, 1u), CONVERT_CHUNK));
+    bool written = seek (out, h.positions);
+
+    // raw positions, summed as centerAndScaleToUnit does
+    Vec3f c;
+    for (unsigned int begin = 0; begin < sizeV && written; begin += CONVERT_CHUNK) {
+        unsigned int n = min (sizeV - begin, CONVERT_CHUNK);
+        for (unsigned int i = 0; i < n; i++) {
+            if (!in.parseVertex (begin + i, &vertices[i][0], what)) {
+                error = source + ":" + what;
+                fclose (out);
+                remove (temporary.c_str ());
+                return false;
+            }
+            c += vertices[i];
+        }
+        written = fwrite (&vertices[0], sizeof (Vec3f), n, out) == n;
+    }
+    c /= sizeV;
+    float maxD = 0.f;
+    bool first = true;
+    written = written && forVertexChunks (out, h.positions, sizeV, vertices, [&] (Vec3f * p, size_t n) {
+        if (first)
+            maxD = dist (p[0], c);
+        first = false;
+        for (size_t i = 0; i < n; i++)
+            maxD = max (maxD, dist (p[i], c));
+        return false;
+    });
+    written = written && forVertexChunks (out, h.positions, sizeV, vertices, [&] (Vec3f * p, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            p[i] = (p[i] - c) / maxD;
+        return true;
+    });
+
+    // indices, through a 16-entry FIFO of the last misses for the ACMR of Mesh::acmr
+    written = written && seek (out, h.indices);
+    unsigned int fifo[16], misses = 0;
+    for (unsigned int begin = 0; begin < sizeT && written; begin += CONVERT_CHUNK) {
+        unsigned int n = min (sizeT - begin, CONVERT_CHUNK);
+        for (unsigned int i = 0; i < n; i++) {
+            if (!in.parseTriangle (begin + i, sizeV, triangles[i].v, what)) {
+                error = source + ":" + what;
+                fclose (out);
+                remove (temporary.c_str ());
+                return false;
+            }
+            for (unsigned int j = 0; j < 3; j++) {
+                unsigned int v = triangles[i].v[j], k = 0;
+                while (k < min (misses, 16u) && fifo[k] != v)
+                    k++;
+                if (k == min (misses, 16u))
+                    fifo[misses++ % 16] = v;
+            }
+        }
+        written = fwrite (&triangles[0], sizeof (Triangle), n, out) == n;
+    }
+    h.acmr = sizeT > 0 ? (float)misses / sizeT : 0.f;
+    written = fclose (out) == 0 && written;
+    sourceFile.close ();
+    if (!written) {
+        error = "cannot write " + temporary;
+        remove (temporary.c_str ());
+        return false;
+    }
+
+    // bounding sphere and normals from the mapped positions and indices, the normals
+    // summed in triangle order as recomputeNormals does, to a file of their own
+    MappedFile mapped;
+    if (!mapped.open (temporary, error)) {
+        remove (temporary.c_str ());
+        return false;
+    }
+    FILE * normals = fopen (normalsTemporary.c_str (), "wb");
+    if (normals == NULL) {
+        error = "cannot write " + normalsTemporary;
+        mapped.close ();
+        remove (temporary.c_str ());
+        return false;
+    }
+    const Vec3f * P = (const Vec3f *)(mapped.data () + h.positions);
+    const Triangle * T = (const Triangle *)(mapped.data () + h.indices);
+    Vec3f center;
+    for (unsigned int i = 0; i < sizeV; i++)
+        center += P[i];
+    center /= sizeV;
+    float radius = 0.f;
+    for (unsigned int i = 0; i < sizeV; i++)
+        radius = max (radius, dist (P[i], center));
+    for (unsigned int k = 0; k < 3; k++)
+        h.center[k] = center[k];
+    h.radius = radius;
+    std::vector<Vec3f> sums (min (sizeV, NORMAL_RANGE));
+    for (unsigned int begin = 0; begin < sizeV && written; begin += NORMAL_RANGE) {
+        unsigned int end = min (sizeV - begin, NORMAL_RANGE) + begin;
+        fill (sums.begin (), sums.end (), Vec3f ());
+        for (unsigned int t = 0; t < sizeT; t++) {
+            const Triangle & tri = T[t];
+            if ((tri.v[0] < begin || tri.v[0] >= end) && (tri.v[1] < begin || tri.v[1] >= end)
+                && (tri.v[2] < begin || tri.v[2] >= end))
+                continue;
+            Vec3f n = cross (P[tri.v[1]] - P[tri.v[0]], P[tri.v[2]] - P[tri.v[0]]);
+            n.normalize ();
+            for (unsigned int j = 0; j < 3; j++)
+                if (tri.v[j] >= begin && tri.v[j] < end)
+                    sums[tri.v[j] - begin] += n;
+        }
+        for (unsigned int i = 0; i < end - begin; i++)
+            sums[i].normalize ();
+        written = fwrite (&sums[0], sizeof (Vec3f), end - begin, normals) == end - begin;
+    }
+    written = fclose (normals) == 0 && written;
+    mapped.close ();
+
+    // normals and header into the cache
+    out = written ? fopen (temporary.c_str (), "r+b") : NULL;
+    normals = out != NULL ? fopen (normalsTemporary.c_str (), "rb") : NULL;
+    written = normals != NULL && seek (out, h.normals);
+    for (unsigned int begin = 0; begin < sizeV && written; begin += CONVERT_CHUNK) {
+        size_t n = min (sizeV - begin, CONVERT_CHUNK);
+        written = fread (&vertices[0], sizeof (Vec3f), n, normals) == n
+            && fwrite (&vertices[0], sizeof (Vec3f), n, out) == n;
+    }
+    const char zeros[64] = { 0 };
+    size_t padding = (size_t)(h.indices - h.normals - 12ull * sizeV);
+    written = written && fwrite (zeros, 1, padding, out) == padding;
+    written = written && seek (out, 0) && fwrite (&h, sizeof (Header), 1, out) == 1;
+    if (normals != NULL)
+        fclose (normals);
+    written = out != NULL && fclose (out) == 0 && written;
+    remove (normalsTemporary.c_str ());
+    if (!written) {
+        error = "cannot write " + temporary;
+        remove (temporary.c_str ());
+        return false;
+    }
+    remove (filename.c_str ());
+    if (rename (temporary.c_str (), filename.c_str ()) != 0) {
+        error = "cannot rename " + temporary + " to " + filename;
+        remove (temporary.c_str ());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,113 @@
+// --------------------------------------------------------------------------
+// Binary mesh cache
+// --------------------------------------------------------------------------
+#pragma once
+#include <cstdint>
+#include <string>
+#include "MappedFile.h"
+
+class Mesh;
+class MeshLOD;
+class ThreadPool;
+
+/// Binary image of a loaded mesh, written next to its source as <source>.xtc so that
+/// later runs skip the text parsing, centerAndScaleToUnit and recomputeNormals.
+/// The file is a Header followed by three 64-byte aligned arrays: the normalized
+/// positions and the normals (3 floats per vertex) and the indices (3 per triangle),
+/// then, with the LODS flag, a table of Level and the indices of each level of detail,
+/// all in the byte order of the machine that wrote it. It is read through a memory
+/// mapping; the source is identified by its size and modification time, or by a
+/// hash of its content when only the time changed (a copy, a touch...), open then storing
+/// the new time in the cache.
+/// The time is kept to the nanosecond, and the hash is not computed when size and time
+/// match, so that opening a cache does not read the whole source: an edit keeping the
+/// size is then missed only on a file system with coarse times (FAT, 2 s) when made
+/// within one tick of the conversion, or when the time is set back by hand.
+class MeshCache {
+public:
+    static const uint32_t VERSION = 4;
+
+    /// Header flags
+    enum {
+        OPTIMIZED = 1,          ///< the mesh went through Mesh::optimizeLocality
+        LODS = 2                ///< the levels of detail of MeshLOD::build follow the mesh
+    };
+
+    struct Header {
+        char magic[8];              ///< "XTOONMC" and a null
+        uint32_t version;
+        uint32_t headerSize;        ///< sizeof (Header), catches layout and byte order changes
+        uint64_t sourceSize;
+        int64_t sourceTime;         ///< modification time, nanoseconds
+        uint64_t sourceHash;
+        uint32_t numVertices;
+        uint32_t numTriangles;
+        uint32_t flags;
+        float acmr;                 ///< of the stored triangle order, 16-entry FIFO
+        float center[3];            ///< bounding sphere of the positions
+        float radius;
+        uint64_t positions;         ///< byte offsets of the arrays
+        uint64_t normals;
+        uint64_t indices;
+        uint64_t levels;            ///< byte offset of the Level table
+        uint32_t numLevels;
+        uint32_t reserved;
+        uint64_t fileSize;
+    };
+
+    struct Level {
+        uint32_t numVertices;
+        uint32_t numTriangles;
+        float error;
+        uint32_t reserved;
+        uint64_t indices;           ///< byte offset of the 3 indices per triangle
+    };
+
+    MeshCache ();
+
+    /// <source>.xtc
+    static std::string filenameFor (const std::string & source);
+
+    /// Maps filename and checks that it is a complete cache of the current version made
+    /// from source; on failure returns false and tells why in error.
+    bool open (const std::string & filename, const std::string & source, std::string & error);
+    void close ();
+
+    /// Fills the mesh from the mapped arrays, in parallel chunks when a pool is given.
+    /// Returns false if an index is out of range (a damaged cache).
+    bool copyTo (Mesh & mesh, ThreadPool * pool = NULL) const;
+    /// Fills the levels of detail (none without the LODS flag); false for a damaged cache.
+    bool copyTo (MeshLOD & lod) const;
+
+    inline const Header & header () const { return *_header; }
+    inline const float * positions () const { return (const float *)(_file.data () + _header->positions); }
+    inline const float * normals () const { return (const float *)(_file.data () + _header->normals); }
+    inline const uint32_t * indices () const { return (const uint32_t *)(_file.data () + _header->indices); }
+
+    /// Writes the cache of mesh, loaded from source, and of its levels of detail when lod is
+    /// given, to filename (through a temporary file renamed at the end, so readers never
+    /// see a partial cache).
+    static bool write (const std::string & filename, const std::string & source, const Mesh & mesh, uint32_t flags,
+                       std::string & error, const MeshLOD * lod = NULL);
+
+    /// Writes the cache of the OFF file source to filename without loading the mesh, for
+    /// meshes larger than memory; the file is the one write would make after Mesh::loadOFF,
+    /// byte for byte with contraction off in both (FPContract.h; benchmark -c checks it).
+    /// The positions are parsed once, summed on the way for centerAndScaleToUnit, then
+    /// scaled chunk by chunk in the file; the normals are gathered over ranges of vertices,
+    /// each range scanning the mapped indices. Peak memory stays at a few chunk buffers,
+    /// whatever the size of the mesh.
+    static bool convert (const std::string & filename, const std::string & source, std::string & error);
+
+    /// 64-bit hash of a byte range, 8 bytes per step.
+    static uint64_t hash (const char * data, size_t size);
+
+private:
+    MappedFile _file;
+    const Header * _header;
+
+    static bool startHeader (Header & h, const std::string & source, std::string & error);
+
+    MeshCache (const MeshCache &);
+    MeshCache & operator= (const MeshCache &);
+};
@@ -0,0 +1,90 @@
+#include "MeshGPU.h"
+#include "MeshLOD.h"
+using namespace std;
+
+MeshGPU::MeshGPU(){}
+
+MeshGPU::~MeshGPU(){
+	release();
+}
+
+void MeshGPU::upload(const Mesh& mesh, const MeshLOD* lod){
+	if (vbo == 0){
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &cbo);
+		glGenBuffers(1, &ibo);
+	}
+	_numVertices = mesh.V.size();
+	levelFirsts.clear();
+	levelCounts.clear();
+	unsigned int numIndices = 0;
+	for (unsigned int l = 0; l < (lod != nullptr ? lod->size() : 1); l++){
+		levelFirsts.push_back(numIndices);
+		levelCounts.push_back(3 * (l == 0 ? mesh.T.size() : lod->levels[l - 1].T.size()));
+		numIndices += levelCounts.back();
+	}
+
+	//Vertex is already the interleaved p.x p.y p.z n.x n.y n.z layout and Triangle
+	//three GLuint, so both arrays are uploaded as they are
+	static_assert(sizeof(Vertex) == 6 * sizeof(float) && sizeof(Triangle) == 3 * sizeof(GLuint), "packed mesh arrays");
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, _numVertices * sizeof(Vertex), mesh.V.empty() ? nullptr : &mesh.V[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, cbo);
+	glBufferData(GL_ARRAY_BUFFER, 3 * _numVertices * sizeof(float), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+	for (unsigned int l = 0; l < levelCounts.size(); l++){
+		const vector<Triangle>& T = l == 0 ? mesh.T : lod->levels[l - 1].T;
+		if (!T.empty())
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, levelFirsts[l] * sizeof(GLuint), levelCounts[l] * sizeof(GLuint), &T[0]);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void MeshGPU::release(){
+	if (vbo != 0){
+		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &cbo);
+		glDeleteBuffers(1, &ibo);
+		vbo = cbo = ibo = 0;
+	}
+	_numVertices = 0;
+	levelFirsts.clear();
+	levelCounts.clear();
+}
+
+void MeshGPU::updateColors(const float* rgb, unsigned int count){
+	if (count == 0 || count > _numVertices)
+		count = _numVertices;
+	glBindBuffer(GL_ARRAY_BUFFER, cbo);
+	//orphan last frame's storage so the driver never waits on it
+	glBufferData(GL_ARRAY_BUFFER, 3 * _numVertices * sizeof(float), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * count * sizeof(float), rgb);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshGPU::draw(bool withColors, unsigned int level){
+	if (numIndices(level) == 0)
+		return;
+	const GLsizei stride = 6 * sizeof(float);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)0);
+	glNormalPointer(GL_FLOAT, stride, (const GLvoid*)(3 * sizeof(float)));
+	if (withColors){
+		glBindBuffer(GL_ARRAY_BUFFER, cbo);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(3, GL_FLOAT, 0, (const GLvoid*)0);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glDrawElements(GL_TRIANGLES, levelCounts[level], GL_UNSIGNED_INT, (const GLvoid*)(levelFirsts[level] * sizeof(GLuint)));
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (withColors)
+		glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include "Mesh.h"
+
+class MeshLOD;
+
+/// GPU-resident copy of a Mesh.
+/// Positions and normals are interleaved in one static VBO and the triangles
+/// live in an IBO, both uploaded once; the CPU X-Toon modes only stream a
+/// per-vertex colour VBO each frame. The triangles of the levels of detail
+/// follow those of the mesh in the same IBO.
+class MeshGPU {
+public:
+	MeshGPU();
+	~MeshGPU();
+
+	//upload (or re-upload) positions, normals and indices of the mesh and of its levels of detail
+	void upload(const Mesh& mesh, const MeshLOD* lod = nullptr);
+	//free the GL buffers
+	void release();
+
+	//stream the rgb triplets of the first count vertices (all by default) for the CPU rendering modes
+	void updateColors(const float* rgb, unsigned int count = 0);
+	//draw the triangles of a level of detail (0: the mesh) with one glDrawElements, with or
+	//without the colour stream
+	void draw(bool withColors, unsigned int level = 0);
+
+	inline unsigned int numVertices() const { return _numVertices; }
+	inline unsigned int numIndices(unsigned int level = 0) const { return level < levelCounts.size() ? levelCounts[level] : 0; }
+
+private:
+	GLuint vbo = 0, cbo = 0, ibo = 0;
+	unsigned int _numVertices = 0;
+	std::vector<unsigned int> levelFirsts, levelCounts;	//index ranges in ibo per level
+	MeshGPU(const MeshGPU&);
+	MeshGPU& operator=(const MeshGPU&);
+};
@@ -0,0 +1,326 @@
+#include "MeshLOD.h"
+#include "Camera.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+namespace {
+	const unsigned int GRAIN = 1 << 14;		//edges per chunk of the collapse costs
+	const float FEATURE_WEIGHT = 10.f;		//of the boundary and crease planes, relative to the face planes
+	const float CREASE_COS = 0.5f;			//dihedral angle over 60 degrees
+	const float MIN_NORMAL_COS = 0.2f;		//a collapse may not turn a face by more than ~78 degrees
+
+	//sum of squared distances to planes, as the symmetric 4x4 matrix of
+	//(n.x n.y n.z d) (n.x n.y n.z d)^T, weighted; w is the total weight
+	struct Quadric {
+		float xx, xy, xz, xd, yy, yz, yd, zz, zd, dd, w;
+
+		Quadric() : xx(0), xy(0), xz(0), xd(0), yy(0), yz(0), yd(0), zz(0), zd(0), dd(0), w(0){}
+
+		inline void addPlane(const Vec3f& n, float d, float weight){
+			xx += weight * n[0] * n[0]; xy += weight * n[0] * n[1]; xz += weight * n[0] * n[2]; xd += weight * n[0] * d;
+			yy += weight * n[1] * n[1]; yz += weight * n[1] * n[2]; yd += weight * n[1] * d;
+			zz += weight * n[2] * n[2]; zd += weight * n[2] * d;
+			dd += weight * d * d;
+			w += weight;
+		}
+		inline Quadric& operator+=(const Quadric& q){
+			xx += q.xx; xy += q.xy; xz += q.xz; xd += q.xd; yy += q.yy; yz += q.yz; yd += q.yd;
+			zz += q.zz; zd += q.zd; dd += q.dd; w += q.w;
+			return *this;
+		}
+		inline float error(const Vec3f& p) const {
+			float x = p[0], y = p[1], z = p[2];
+			float e = x * (xx * x + 2 * (xy * y + xz * z + xd)) + y * (yy * y + 2 * (yz * z + yd))
+				+ z * (zz * z + 2 * zd) + dd;
+			return max(e, 0.f);
+		}
+	};
+
+	inline uint64_t edgeKey(unsigned int a, unsigned int b){
+		return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+	}
+
+	inline Vec3f faceNormal(const Mesh& mesh, const Triangle& t){
+		const Vec3f& p0 = mesh.V[t.v[0]].p;
+		return cross(mesh.V[t.v[1]].p - p0, mesh.V[t.v[2]].p - p0);
+	}
+
+	struct Collapse {
+		float cost;
+		unsigned int from, to;
+		inline bool operator<(const Collapse& c) const { return cost < c.cost; }
+	};
+
+	//greedy edge collapse over the triangles T, in passes: each pass sorts the collapses
+	//of every edge by cost and applies the cheapest ones whose neighbourhoods do not
+	//touch (a collapse locks the vertices around both ends), so the adjacency of a pass
+	//stays valid without updates. The quadrics keep accumulating from the full surface
+	//across calls to reduce
+	class Simplifier {
+	public:
+		vector<Triangle> T;
+		float error;
+
+		Simplifier(const Mesh& mesh, const vector<Triangle>& triangles, ThreadPool* pool)
+			: T(triangles), error(0.f), mesh(mesh), pool(pool), quadrics(mesh.V.size()),
+			remap(mesh.V.size()), locked(mesh.V.size()), mark(mesh.V.size(), 0), stamp(0){
+			//face planes, weighted by area
+			for (unsigned int i = 0; i < T.size(); i++){
+				Vec3f n = faceNormal(mesh, T[i]);
+				float area = n.normalize();
+				if (area == 0.f)
+					continue;
+				float d = -dot(n, mesh.V[T[i].v[0]].p);
+				for (unsigned int j = 0; j < 3; j++)
+					quadrics[T[i].v[j]].addPlane(n, d, area * .5f);
+			}
+			//planes through the boundary and crease edges, perpendicular to their faces
+			vector<pair<uint64_t, unsigned int> > edges(3 * T.size());
+			for (unsigned int i = 0; i < T.size(); i++)
+				for (unsigned int j = 0; j < 3; j++)
+					edges[3 * i + j] = make_pair(edgeKey(T[i].v[j], T[i].v[(j + 1) % 3]), i);
+			sort(edges.begin(), edges.end());
+			for (size_t k = 0; k < edges.size();){
+				size_t end = k + 1;
+				while (end < edges.size() && edges[end].first == edges[k].first)
+					end++;
+				bool feature = end - k == 1;
+				if (end - k == 2){
+					Vec3f n0 = normalize(faceNormal(mesh, T[edges[k].second]));
+					Vec3f n1 = normalize(faceNormal(mesh, T[edges[k + 1].second]));
+					feature = dot(n0, n1) < CREASE_COS;
+				}
+				if (feature){
+					unsigned int a = (unsigned int)(edges[k].first >> 32), b = (unsigned int)edges[k].first;
+					Vec3f e = mesh.V[b].p - mesh.V[a].p;
+					float length2 = e.squaredLength();
+					for (size_t f = k; f < end; f++){
+						Vec3f m = cross(e, faceNormal(mesh, T[edges[f].second]));
+						if (m.normalize() == 0.f)
+							continue;
+						float d = -dot(m, mesh.V[a].p);
+						quadrics[a].addPlane(m, d, FEATURE_WEIGHT * length2);
+						quadrics[b].addPlane(m, d, FEATURE_WEIGHT * length2);
+					}
+				}
+				k = end;
+			}
+		}
+
+		//collapse edges until T has at most target triangles, or no collapse is allowed
+		void reduce(unsigned int target){
+			while (T.size() > target && pass(target))
+				;
+		}
+
+	private:
+		const Mesh& mesh;
+		ThreadPool* pool;
+		vector<Quadric> quadrics;
+		vector<unsigned int> remap;
+		vector<unsigned char> locked;
+		vector<unsigned int> mark;		//per vertex, stamp of the last link test marking it
+		unsigned int stamp;
+		vector<unsigned int> start, around;		//vertex to triangle adjacency of T
+		vector<uint64_t> keys;
+		vector<Collapse> collapses;
+
+		bool pass(unsigned int target){
+			unsigned int numV = (unsigned int)mesh.V.size(), numT = (unsigned int)T.size();
+			start.assign(numV + 1, 0);
+			for (unsigned int i = 0; i < numT; i++)
+				for (unsigned int j = 0; j < 3; j++)
+					start[T[i].v[j] + 1]++;
+			for (unsigned int v = 0; v < numV; v++)
+				start[v + 1] += start[v];
+			around.resize(3 * numT);
+			vector<unsigned int> next(start.begin(), start.end() - 1);
+			for (unsigned int i = 0; i < numT; i++)
+				for (unsigned int j = 0; j < 3; j++)
+					around[next[T[i].v[j]]++] = i;
+
+			//every edge once, collapsed towards its cheaper end
+			keys.resize(3 * numT);
+			for (unsigned int i = 0; i < numT; i++)
+				for (unsigned int j = 0; j < 3; j++)
+					keys[3 * i + j] = edgeKey(T[i].v[j], T[i].v[(j + 1) % 3]);
+			sort(keys.begin(), keys.end());
+			keys.erase(unique(keys.begin(), keys.end()), keys.end());
+			collapses.resize(keys.size());
+			forChunks(pool, (unsigned int)keys.size(), GRAIN, [&](unsigned int begin, unsigned int end){
+				for (unsigned int k = begin; k < end; k++){
+					unsigned int a = (unsigned int)(keys[k] >> 32), b = (unsigned int)keys[k];
+					Quadric q = quadrics[a];
+					q += quadrics[b];
+					float toB = q.error(mesh.V[b].p), toA = q.error(mesh.V[a].p);
+					collapses[k].cost = min(toA, toB);
+					collapses[k].from = toB <= toA ? a : b;
+					collapses[k].to = toB <= toA ? b : a;
+				}
+			});
+			sort(collapses.begin(), collapses.end());
+
+			//an interior collapse removes 2 triangles: no collapse costlier than the
+			//cheapest ones needed to reach the target, once an eighth of those went through
+			//(the locks and the tests reject many of them: without that slack, the last
+			//passes of a level would each apply a single collapse)
+			size_t needed = (size_t)(numT - target + 1) / 2;
+			float limit = collapses.empty() ? 0.f : collapses[min(collapses.size(), needed) - 1].cost;
+			for (unsigned int v = 0; v < numV; v++)
+				remap[v] = v;
+			fill(locked.begin(), locked.end(), 0);
+			unsigned int remaining = numT, applied = 0;
+			for (size_t k = 0; k < collapses.size() && remaining > target; k++){
+				const Collapse& c = collapses[k];
+				if (c.cost > limit && 8 * applied >= needed)
+					break;
+				if (locked[c.from] || locked[c.to])
+					continue;
+				unsigned int removed;
+				if (!allowed(c.from, c.to, removed))
+					continue;
+				remap[c.from] = c.to;
+				quadrics[c.to] += quadrics[c.from];
+				error = max(error, sqrt(c.cost / max(quadrics[c.to].w, 1e-20f)));
+				lock(c.from);
+				lock(c.to);
+				remaining -= removed;
+				applied++;
+			}
+			if (applied == 0)
+				return false;
+
+			unsigned int kept = 0;
+			for (unsigned int i = 0; i < numT; i++){
+				Triangle t(remap[T[i].v[0]], remap[T[i].v[1]], remap[T[i].v[2]]);
+				if (t.v[0] != t.v[1] && t.v[1] != t.v[2] && t.v[2] != t.v[0])
+					T[kept++] = t;
+			}
+			T.resize(kept);
+			return true;
+		}
+
+		void lock(unsigned int v){
+			for (unsigned int k = start[v]; k < start[v + 1]; k++)
+				for (unsigned int j = 0; j < 3; j++)
+					locked[T[around[k]].v[j]] = 1;
+		}
+
+		//whether moving from onto to keeps the surface manifold (the only vertices around
+		//both are those of the triangles on the edge) and turns no face over; removed is
+		//the number of triangles on the edge
+		bool allowed(unsigned int from, unsigned int to, unsigned int& removed){
+			if (++stamp == 0){
+				fill(mark.begin(), mark.end(), 0);
+				stamp = 1;
+			}
+			removed = 0;
+			for (unsigned int k = start[from]; k < start[from + 1]; k++){
+				const Triangle& t = T[around[k]];
+				bool onEdge = t.v[0] == to || t.v[1] == to || t.v[2] == to;
+				removed += onEdge;
+				for (unsigned int j = 0; j < 3; j++)
+					mark[t.v[j]] = stamp;
+				if (onEdge)
+					continue;
+				Vec3f before = faceNormal(mesh, t);
+				Triangle moved = t;
+				for (unsigned int j = 0; j < 3; j++)
+					if (moved.v[j] == from)
+						moved.v[j] = to;
+				Vec3f after = faceNormal(mesh, moved);
+				float l = after.length() * before.length();
+				if (l == 0.f || dot(before, after) < MIN_NORMAL_COS * l)
+					return false;
+			}
+			if (removed == 0 || removed > 2)
+				return false;
+			unsigned int common = 0;
+			++stamp;
+			for (unsigned int k = start[to]; k < start[to + 1]; k++){
+				const Triangle& t = T[around[k]];
+				for (unsigned int j = 0; j < 3; j++){
+					unsigned int v = t.v[j];
+					if (v != from && v != to && mark[v] == stamp - 1){
+						mark[v] = stamp;
+						common++;
+					}
+				}
+			}
+			return common == removed;
+		}
+	};
+}
+
+float MeshLOD::simplify(const Mesh& mesh, const vector<Triangle>& T, unsigned int target,
+	vector<Triangle>& result, ThreadPool* pool){
+	Simplifier simplifier(mesh, T, pool);
+	simplifier.reduce(target);
+	result.swap(simplifier.T);
+	return simplifier.error;
+}
+
+void MeshLOD::build(Mesh& mesh, float ratio, unsigned int minTriangles, ThreadPool* pool){
+	levels.clear();
+	if (mesh.T.size() <= minTriangles)
+		return;
+	Simplifier simplifier(mesh, mesh.T, pool);
+	for (unsigned int target = (unsigned int)(mesh.T.size() * ratio); target >= minTriangles;
+		target = (unsigned int)(target * ratio)){
+		simplifier.reduce(target);
+		size_t previous = levels.empty() ? mesh.T.size() : levels.back().T.size();
+		if (simplifier.T.size() >= previous)
+			break;
+		LODLevel level;
+		level.T = simplifier.T;
+		level.error = simplifier.error;
+		levels.push_back(level);
+	}
+
+	//vertices of the coarsest levels first, in their former order otherwise
+	unsigned int numV = (unsigned int)mesh.V.size(), numLevels = (unsigned int)levels.size();
+	vector<unsigned int> rank(numV, 0);		//1 + the coarsest level using the vertex, 0 if none
+	for (unsigned int l = 0; l <= numLevels; l++){
+		const vector<Triangle>& T = triangles(mesh, l);
+		for (unsigned int i = 0; i < T.size(); i++)
+			for (unsigned int j = 0; j < 3; j++)
+				rank[T[i].v[j]] = l + 1;
+	}
+	vector<unsigned int> first(numLevels + 3, 0);		//counting sort on numLevels + 1 - rank
+	for (unsigned int v = 0; v < numV; v++)
+		first[numLevels + 2 - rank[v]]++;
+	for (unsigned int r = 0; r + 1 < first.size(); r++)
+		first[r + 1] += first[r];
+	for (unsigned int l = 0; l < numLevels; l++)
+		levels[l].numVertices = first[numLevels - l];
+	vector<unsigned int> remap(numV);
+	for (unsigned int v = 0; v < numV; v++)
+		remap[v] = first[numLevels + 1 - rank[v]]++;
+	vector<Vertex> reordered(numV);
+	for (unsigned int v = 0; v < numV; v++)
+		reordered[remap[v]] = mesh.V[v];
+	mesh.V.swap(reordered);
+	for (unsigned int l = 0; l <= numLevels; l++){
+		vector<Triangle>& T = l == 0 ? mesh.T : levels[l - 1].T;
+		for (unsigned int i = 0; i < T.size(); i++)
+			for (unsigned int j = 0; j < 3; j++)
+				T[i].v[j] = remap[T[i].v[j]];
+	}
+	mesh.adjacencyStart.clear();
+	mesh.adjacentCorners.clear();
+}
+
+unsigned int MeshLOD::select(const Mesh& mesh, Camera& camera, float maxPixels) const {
+	const CameraState& s = camera.state();
+	float distance = max(dist(s.pos, mesh.center) - mesh.radius, camera.getNearPlane());
+	float pixelsPerUnit = camera.getScreenHeight()
+		/ (2.f * distance * (float)tan(camera.getFovAngle() * 3.14159265358979323846 / 360.));
+	unsigned int level = 0;
+	while (level < levels.size() && levels[level].error * pixelsPerUnit <= maxPixels)
+		level++;
+	return level;
+}
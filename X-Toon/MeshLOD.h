@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include "Mesh.h"
+
+class Camera;
+class ThreadPool;
+
+/// A coarser version of a mesh: triangles over the first numVertices vertices of its V.
+struct LODLevel {
+	unsigned int numVertices = 0;
+	float error = 0.f;		//estimated distance to the full surface, in model units
+	std::vector<Triangle> T;
+};
+
+/// Chain of levels of detail of a Mesh, made by quadric error edge collapse (Garland and
+/// Heckbert 1997). The collapses only remove vertices, so every level indexes the vertices
+/// of the mesh, with their positions and smooth normals; build() orders V by the coarsest
+/// level using each vertex, so that a level uses a prefix of V and the CPU shading of a
+/// level only runs over that prefix.
+/// Boundary and crease edges (dihedral angle over 60 degrees) keep their shape through
+/// extra constraint planes, and no collapse may turn a face by more than about 80
+/// degrees: the outlines and the normals the silhouette and highlight modes depend on
+/// are what goes last.
+class MeshLOD {
+public:
+	//levels[k] is level k + 1, level 0 being the mesh itself; errors increase with k
+	std::vector<LODLevel> levels;
+
+	//build the chain, each level having about ratio times the triangles of the previous one
+	//and at least minTriangles (none for a mesh with less than minTriangles / ratio);
+	//reorders mesh.V (and renumbers mesh.T) as explained above
+	void build(Mesh& mesh, float ratio = 0.25f, unsigned int minTriangles = 4096, ThreadPool* pool = nullptr);
+	inline void clear(){ levels.clear(); }
+
+	//number of levels, the mesh itself included
+	inline unsigned int size() const { return (unsigned int)levels.size() + 1; }
+	inline unsigned int numVertices(const Mesh& mesh, unsigned int level) const {
+		return level == 0 ? (unsigned int)mesh.V.size() : levels[level - 1].numVertices;
+	}
+	inline const std::vector<Triangle>& triangles(const Mesh& mesh, unsigned int level) const {
+		return level == 0 ? mesh.T : levels[level - 1].T;
+	}
+
+	//coarsest level whose error, projected at the distance of the bounding sphere of the
+	//mesh from the camera, stays under maxPixels on screen
+	unsigned int select(const Mesh& mesh, Camera& camera, float maxPixels = 1.f) const;
+
+	//simplify T (over mesh.V) to about target triangles, return the error reached
+	static float simplify(const Mesh& mesh, const std::vector<Triangle>& T, unsigned int target,
+		std::vector<Triangle>& result, ThreadPool* pool = nullptr);
+};
@@ -0,0 +1,56 @@
+#include "MeshStream.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+bool MeshStream::open (const std::string & filename, std::string * error, ThreadPool * pool) {
+    std::string cacheFilename = MeshCache::filenameFor (filename), message;
+    if (!_cache.open (cacheFilename, filename, message)
+        && (!MeshCache::convert (cacheFilename, filename, message) || !_cache.open (cacheFilename, filename, message))) {
+        if (error != NULL)
+            *error = message;
+        return false;
+    }
+    unsigned int numT = numTriangles (), numV = numVertices ();
+    const uint32_t * indices = _cache.indices ();
+    std::atomic<bool> inRange (true);
+    auto check = [&] (unsigned int begin, unsigned int end) {
+        uint32_t maxIndex = 0;
+        for (size_t i = 3 * (size_t)begin; i < 3 * (size_t)end; i++)
+            maxIndex = max (maxIndex, indices[i]);
+        if (maxIndex >= numV)
+            inRange = false;
+    };
+    forChunks (pool, numT, CHUNK, check);
+    if (!inRange) {
+        if (error != NULL)
+            *error = cacheFilename + " is truncated or corrupted";
+        close ();
+        return false;
+    }
+    return true;
+}
+
+void MeshStream::close () {
+    _cache.close ();
+}
+
+void MeshStream::read (unsigned int first, unsigned int count, Mesh & chunk) const {
+    unsigned int end = min (first + count, numTriangles ());
+    count = end > first ? end - first : 0;
+    const Vec3f * P = positions ();
+    const Vec3f * N = normals ();
+    const Triangle * T = triangles ();
+    chunk.V.resize (3 * count);
+    chunk.T.resize (count);
+    chunk.adjacencyStart.clear ();
+    chunk.adjacentCorners.clear ();
+    for (unsigned int i = 0; i < count; i++)
+        for (unsigned int j = 0; j < 3; j++) {
+            unsigned int v = T[first + i].v[j];
+            chunk.V[3 * i + j] = Vertex (P[v], N[v]);
+            chunk.T[i].v[j] = 3 * i + j;
+        }
+}
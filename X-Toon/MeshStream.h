@@ -0,0 +1,43 @@
+// --------------------------------------------------------------------------
+// Out-of-core meshes
+// --------------------------------------------------------------------------
+#pragma once
+#include <string>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "MeshCache.h"
+
+class ThreadPool;
+
+/// Read-only access to a mesh too large to load, through its binary cache: the arrays
+/// stay in the file mapping, paged in by the system as they are read and dropped again
+/// under memory pressure, and the triangles are handed out in chunks of CHUNK.
+/// open() writes the cache with MeshCache::convert when it is missing or out of date,
+/// which does not hold the mesh either.
+class MeshStream {
+public:
+    static const unsigned int CHUNK = 1 << 16;
+
+    /// Opens the cache of the OFF file filename, converting it first if needed; on
+    /// failure returns false and tells why in error. The indices are checked once, in
+    /// parallel chunks with a pool.
+    bool open (const std::string & filename, std::string * error = NULL, ThreadPool * pool = NULL);
+    void close ();
+
+    inline unsigned int numVertices () const { return _cache.header ().numVertices; }
+    inline unsigned int numTriangles () const { return _cache.header ().numTriangles; }
+    /// Positions and normals as Mesh::loadOFF sets them, mapped from the cache
+    inline const Vec3f * positions () const { return (const Vec3f *)_cache.positions (); }
+    inline const Vec3f * normals () const { return (const Vec3f *)_cache.normals (); }
+    inline const Triangle * triangles () const { return (const Triangle *)_cache.indices (); }
+    /// Bounding sphere of the positions
+    inline Vec3f center () const { return Vec3f (_cache.header ().center[0], _cache.header ().center[1], _cache.header ().center[2]); }
+    inline float radius () const { return _cache.header ().radius; }
+
+    /// Copies the triangles [first, first + count) to chunk.T, over vertices of their own:
+    /// corner j of triangle first + i is chunk.V[3 * i + j]. Fewer at the end of the mesh.
+    void read (unsigned int first, unsigned int count, Mesh & chunk) const;
+
+private:
+    MeshCache _cache;
+};
@@ -0,0 +1,204 @@
+#include "Meshlets.h"
+#include <algorithm>
+#include <cmath>
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+	const unsigned int NO_MESHLET = 0xffffffff;
+	const unsigned int GRAIN = 256;	//meshlets per chunk of the culling loop
+
+	//distinct vertices of tri not yet in meshlet id
+	inline unsigned int newVertices(const Triangle& tri, const vector<unsigned int>& inMeshlet, unsigned int id){
+		unsigned int added = 0;
+		for (int j = 0; j < 3; j++){
+			unsigned int v = tri.v[j];
+			bool repeated = (j > 0 && v == tri.v[0]) || (j > 1 && v == tri.v[1]);
+			added += inMeshlet[v] != id && !repeated;
+		}
+		return added;
+	}
+}
+
+void Meshlets::build(const Mesh& mesh){
+	unsigned int numV = (unsigned int)mesh.V.size(), numT = (unsigned int)mesh.T.size();
+	meshlets.clear();
+	triangles.clear();
+	owned.clear();
+	borrowed.clear();
+	triangleMeshlet.assign(numT, NO_MESHLET);
+	owner.assign(numV, NO_MESHLET);
+	listed.assign(numV, 0);
+	calls = 0;
+
+	//vertex to triangle adjacency, and unit face normals (zero for degenerate faces)
+	vector<unsigned int> start(numV + 1, 0), around(3 * numT);
+	for (unsigned int t = 0; t < numT; t++)
+		for (int j = 0; j < 3; j++)
+			start[mesh.T[t].v[j] + 1]++;
+	for (unsigned int v = 0; v < numV; v++)
+		start[v + 1] += start[v];
+	vector<unsigned int> fill(start.begin(), start.end() - 1);
+	for (unsigned int t = 0; t < numT; t++)
+		for (int j = 0; j < 3; j++)
+			around[fill[mesh.T[t].v[j]]++] = t;
+	vector<Vec3f> normals(numT);
+	for (unsigned int t = 0; t < numT; t++){
+		const Triangle& tri = mesh.T[t];
+		normals[t] = cross(mesh.V[tri.v[1]].p - mesh.V[tri.v[0]].p, mesh.V[tri.v[2]].p - mesh.V[tri.v[0]].p);
+		normals[t].normalize();
+	}
+
+	//free triangles touching the current meshlet, bucketed by how many vertices they would
+	//add; an entry is stale once the triangle is taken or its count has dropped
+	vector<unsigned int> local;			//distinct vertices of the current meshlet
+	vector<unsigned int> candidates[3];
+	vector<unsigned int> inMeshlet(numV, NO_MESHLET);
+	vector<unsigned char> missing(numT);
+	unsigned int seed = 0;
+	while (true){
+		while (seed < numT && triangleMeshlet[seed] != NO_MESHLET)
+			seed++;
+		if (seed == numT)
+			break;
+		unsigned int id = (unsigned int)meshlets.size();
+		Meshlet m;
+		m.firstTriangle = (unsigned int)triangles.size();
+		m.firstOwned = (unsigned int)owned.size();
+		m.firstBorrowed = (unsigned int)borrowed.size();
+		local.clear();
+		for (int a = 0; a < 3; a++)
+			candidates[a].clear();
+		Vec3f axis;
+		unsigned int t = seed;
+		while (true){
+			triangleMeshlet[t] = id;
+			triangles.push_back(t);
+			axis += normals[t];
+			for (int j = 0; j < 3; j++){
+				unsigned int v = mesh.T[t].v[j];
+				if (inMeshlet[v] == id)
+					continue;
+				inMeshlet[v] = id;
+				local.push_back(v);
+				if (owner[v] == NO_MESHLET){
+					owner[v] = id;
+					owned.push_back(v);
+				}
+				else
+					borrowed.push_back(v);
+				for (unsigned int k = start[v]; k < start[v + 1]; k++){
+					unsigned int c = around[k];
+					if (triangleMeshlet[c] == NO_MESHLET){
+						missing[c] = (unsigned char)newVertices(mesh.T[c], inMeshlet, id);
+						candidates[missing[c]].push_back(c);
+					}
+				}
+			}
+			if (triangles.size() - m.firstTriangle == MAX_TRIANGLES)
+				break;
+			//fewest new vertices first, then the normal closest to the mean one
+			Vec3f dir = normalize(axis);
+			unsigned int best = NO_MESHLET;
+			for (unsigned int a = 0; a < 3 && best == NO_MESHLET && local.size() + a <= MAX_VERTICES; a++){
+				vector<unsigned int>& bucket = candidates[a];
+				unsigned int kept = 0;
+				float bestDot = -2.f;
+				for (unsigned int k = 0; k < bucket.size(); k++){
+					unsigned int c = bucket[k];
+					if (triangleMeshlet[c] != NO_MESHLET || missing[c] != a)
+						continue;
+					bucket[kept++] = c;
+					float d = dot(normals[c], dir);
+					if (d > bestDot){
+						best = c;
+						bestDot = d;
+					}
+				}
+				bucket.resize(kept);
+			}
+			if (best == NO_MESHLET)
+				break;
+			t = best;
+		}
+		m.numTriangles = (unsigned int)triangles.size() - m.firstTriangle;
+		m.numOwned = (unsigned int)owned.size() - m.firstOwned;
+		m.numBorrowed = (unsigned int)borrowed.size() - m.firstBorrowed;
+
+		//bounding sphere around the centroid of the vertices
+		Vec3f c;
+		for (unsigned int k = 0; k < local.size(); k++)
+			c += mesh.V[local[k]].p;
+		c /= (float)local.size();
+		float r = 0.f;
+		for (unsigned int k = 0; k < local.size(); k++)
+			r = max(r, dist(mesh.V[local[k]].p, c));
+		m.center = c;
+		m.radius = r;
+
+		//normal cone around the mean face normal; degenerate faces are never drawn and
+		//are left out, a wide cone (more than ~84 degrees) is not worth testing
+		float minDot = -1.f;
+		if (axis.normalize() > 0.f){
+			minDot = 1.f;
+			for (unsigned int k = m.firstTriangle; k < triangles.size(); k++)
+				if (normals[triangles[k]].squaredLength() > 0.f)
+					minDot = min(minDot, dot(normals[triangles[k]], axis));
+		}
+		m.axis = axis;
+		m.cutoff = minDot <= 0.1f ? 2.f : sqrt(1.f - minDot * minDot);
+		meshlets.push_back(m);
+	}
+	visibility.assign(meshlets.size(), 1);
+}
+
+//back-facing when every point p of the sphere and every normal n of the cone have
+//dot(n, p - eye) > 0, conservatively: dot(d, axis) >= cutoff * |d| + radius with d = center - eye;
+//outside when the sphere is entirely beyond one plane of the gluPerspective frustum
+unsigned int Meshlets::cull(Camera& camera, ThreadPool* pool){
+	const CameraState& s = camera.state();
+	float n = camera.getNearPlane(), f = camera.getFarPlane();
+	float sy = (float)(1. / tan(camera.getFovAngle() * 3.14159265358979323846 / 360.));
+	float sx = sy / camera.getAspectRatio();
+	float nx = 1.f / sqrt(sx * sx + 1.f), ny = 1.f / sqrt(sy * sy + 1.f);
+	ThreadPool::RangeFunc fn = [&](unsigned int begin, unsigned int end){
+		for (unsigned int i = begin; i < end; i++){
+			const Meshlet& m = meshlets[i];
+			Vec3f d = m.center - s.pos;
+			bool back = dot(d, m.axis) >= m.cutoff * d.length() + m.radius;
+			Vec3f e = s.toEye(m.center);
+			bool outside = e[2] > -n + m.radius || -e[2] - m.radius > f
+				|| (sx * fabs(e[0]) + e[2]) * nx > m.radius || (sy * fabs(e[1]) + e[2]) * ny > m.radius;
+			visibility[i] = !(back || outside);
+		}
+	};
+	forChunks(pool, size(), GRAIN, fn);
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < size(); i++)
+		count += visibility[i];
+	return count;
+}
+
+void Meshlets::visibleVertices(vector<unsigned int>& vertices){
+	vertices.clear();
+	if (++calls == 0){
+		fill(listed.begin(), listed.end(), 0);
+		calls = 1;
+	}
+	//owned vertices are listed by their one owner, borrowed ones by the first visible
+	//borrower when the owner is culled
+	for (unsigned int i = 0; i < size(); i++){
+		if (!visibility[i])
+			continue;
+		const Meshlet& m = meshlets[i];
+		vertices.insert(vertices.end(), owned.begin() + m.firstOwned, owned.begin() + m.firstOwned + m.numOwned);
+		for (unsigned int k = m.firstBorrowed; k < m.firstBorrowed + m.numBorrowed; k++){
+			unsigned int v = borrowed[k];
+			if (!visibility[owner[v]] && listed[v] != calls){
+				listed[v] = calls;
+				vertices.push_back(v);
+			}
+		}
+	}
+}
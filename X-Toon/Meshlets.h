@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Camera.h"
+
+class ThreadPool;
+
+/// Partition of a mesh into meshlets: connected patches of at most MAX_TRIANGLES
+/// triangles using at most MAX_VERTICES distinct vertices, each with a bounding sphere
+/// and a cone bounding its face normals. cull() flags, once per frame, the meshlets
+/// that are entirely back-facing (normal cone) or outside the view frustum (bounding
+/// sphere), so that the CPU paths skip their vertices and triangles.
+///
+/// A meshlet grows from the first free triangle in mesh order by adding the
+/// neighbouring triangle that brings the fewest new vertices, then the one whose
+/// normal is closest to the meshlet's: compact patches with narrow normal cones.
+/// The mesh itself is not reordered.
+/// Each vertex is owned by the first meshlet using it; the other meshlets using it
+/// borrow it, and visibleVertices() lists it once when any of them is visible.
+class Meshlets {
+public:
+	static const unsigned int MAX_VERTICES = 64;
+	static const unsigned int MAX_TRIANGLES = 124;
+
+	struct Meshlet {
+		unsigned int firstTriangle, numTriangles;	//triangles[firstTriangle ..], indices in mesh.T
+		unsigned int firstOwned, numOwned;			//owned[firstOwned ..]: vertices first used here
+		unsigned int firstBorrowed, numBorrowed;	//borrowed[firstBorrowed ..]: the others
+		Vec3f center;
+		float radius;
+		Vec3f axis;		//normal cone: every face normal n has dot(n, axis) >= sqrt(1 - cutoff^2)
+		float cutoff;	//sine of the cone half-angle, > 1 when the cone is too wide to cull
+	};
+
+	//partition the triangles of mesh, to call again whenever mesh changes
+	void build(const Mesh& mesh);
+
+	inline unsigned int size() const { return (unsigned int)meshlets.size(); }
+	inline const Meshlet& operator[](unsigned int i) const { return meshlets[i]; }
+	//triangles of the meshlets, in meshlet order
+	inline unsigned int triangle(unsigned int k) const { return triangles[k]; }
+	//meshlet holding triangle t
+	inline unsigned int meshletOf(unsigned int t) const { return triangleMeshlet[t]; }
+
+	//flag the meshlets that may show a front-facing triangle in the view of camera,
+	//return how many are visible
+	unsigned int cull(Camera& camera, ThreadPool* pool = nullptr);
+	inline bool visible(unsigned int i) const { return visibility[i] != 0; }
+	//every vertex used by a visible meshlet, once (after cull)
+	void visibleVertices(std::vector<unsigned int>& vertices);
+
+private:
+	std::vector<Meshlet> meshlets;
+	std::vector<unsigned int> triangles;
+	std::vector<unsigned int> triangleMeshlet;
+	std::vector<unsigned int> owned, borrowed;
+	std::vector<unsigned int> owner;		//per vertex, the meshlet owning it
+	std::vector<unsigned char> visibility;
+	std::vector<unsigned int> listed;		//per vertex, last visibleVertices call listing it
+	unsigned int calls = 0;
+};
@@ -0,0 +1,175 @@
+// --------------------------------------------------------------------------
+// Tokenizer of the OFF mesh format
+// --------------------------------------------------------------------------
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/// Scanner over the bytes of an OFF file, whitespace and # comments are skipped before every token.
+/// Numbers are parsed as ifstream >> would in the "C" locale, floats correctly rounded.
+class OFFScanner {
+public:
+    OFFScanner (const char * begin, const char * end) : begin (begin), p (begin), end (end) {}
+
+    static inline bool isDigit (char c) { return (unsigned char)(c - '0') < 10; }
+    static inline bool isSpace (char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v'; }
+
+    void skip () {
+        while (p < end) {
+            if (isSpace (*p))
+                p++;
+            else if (*p == '#')
+                while (p < end && *p != '\n')
+                    p++;
+            else
+                break;
+        }
+    }
+
+    /// Skips what remains of the current line (colours or other per-element data).
+    void skipLine () {
+        while (p < end && *p != '\n')
+            p++;
+    }
+
+    bool parseWord (std::string & w) {
+        skip ();
+        const char * b = p;
+        while (p < end && !isSpace (*p))
+            p++;
+        w.assign (b, p);
+        return p > b;
+    }
+
+    bool parseUInt (unsigned int & v) {
+        skip ();
+        const char * b = p;
+        unsigned long long x = 0;
+        while (p < end && isDigit (*p) && x <= 0xffffffffull)
+            x = x * 10 + (*p++ - '0');
+        v = (unsigned int)x;
+        return p > b && x <= 0xffffffffull && (p == end || isSpace (*p) || *p == '#');
+    }
+
+    /// Up to 7 significant digits and a power of ten up to 10 (the usual case for mesh files)
+    /// give an exact float division or multiplication; anything else goes through strtof.
+    bool parseFloat (float & v) {
+        skip ();
+        const char * b = p;
+        bool negative = (p < end && *p == '-');
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+        unsigned long long m = 0;
+        int digits = 0, e10 = 0;
+        const char * d = p;
+        while (p < end && isDigit (*p)) {
+            m = m * 10 + (*p++ - '0');
+            digits += (m != 0);
+        }
+        if (p < end && *p == '.') {
+            p++;
+            while (p < end && isDigit (*p)) {
+                m = m * 10 + (*p++ - '0');
+                digits += (m != 0);
+                e10--;
+            }
+        }
+        bool fast = (p - d) > 0 && !(p - d == 1 && *d == '.') && digits <= 18;
+        if (fast && p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool negativeExp = (p < end && *p == '-');
+            if (p < end && (*p == '-' || *p == '+'))
+                p++;
+            int x = 0;
+            const char * xd = p;
+            while (p < end && isDigit (*p) && x < 10000)
+                x = x * 10 + (*p++ - '0');
+            fast = p > xd && x < 10000;
+            e10 += negativeExp ? -x : x;
+        }
+        fast = fast && (p == end || isSpace (*p)) && m < (1u << 24) && e10 >= -10 && e10 <= 10;
+        if (fast) {
+            static const float POW10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+            float f = (float)m;
+            f = e10 < 0 ? f / POW10[-e10] : f * POW10[e10];
+            v = negative ? -f : f;
+            return true;
+        }
+        //exact fallback on a null-terminated copy of the token
+        p = b;
+        while (p < end && !isSpace (*p))
+            p++;
+        char token[64];
+        if (p == b || p - b >= (long)sizeof (token))
+            return false;
+        memcpy (token, b, p - b);
+        token[p - b] = '\0';
+        char * stop;
+        v = strtof (token, &stop);
+        return *stop == '\0';
+    }
+
+    /// "OFF" and the vertex, face and edge counts, then the end of their line.
+    bool parseHeader (unsigned int & sizeV, unsigned int & sizeT, std::string & what) {
+        std::string header;
+        unsigned int sizeE;
+        if (!parseWord (header) || header.find ("OFF") == std::string::npos)
+            return failed ("missing OFF header", what);
+        if (!parseUInt (sizeV) || !parseUInt (sizeT) || !parseUInt (sizeE))
+            return failed ("expected vertex, face and edge counts", what);
+        if (sizeV == 0)
+            return failed ("no vertices", what);
+        skipLine ();
+        return true;
+    }
+
+    /// Coordinates of vertex i, then the end of its line.
+    bool parseVertex (unsigned int i, float * p, std::string & what) {
+        if (!parseFloat (p[0]) || !parseFloat (p[1]) || !parseFloat (p[2]))
+            return failed ("bad or missing coordinates for vertex " + std::to_string (i), what);
+        skipLine ();
+        return true;
+    }
+
+    /// Indices of triangle face i over sizeV vertices, then the end of its line.
+    bool parseTriangle (unsigned int i, unsigned int sizeV, unsigned int * v, std::string & what) {
+        unsigned int n;
+        if (!parseUInt (n))
+            return failed ("bad or missing face " + std::to_string (i), what);
+        if (n != 3)
+            return failed ("face " + std::to_string (i) + " has " + std::to_string (n) + " vertices, only triangles are supported", what);
+        if (!parseUInt (v[0]) || !parseUInt (v[1]) || !parseUInt (v[2]))
+            return failed ("bad or missing indices for face " + std::to_string (i), what);
+        if (v[0] >= sizeV || v[1] >= sizeV || v[2] >= sizeV)
+            return failed ("face " + std::to_string (i) + " indexes a vertex out of range", what);
+        skipLine ();
+        return true;
+    }
+
+    const char * position () const { return p; }
+
+    bool atEnd () {
+        skip ();
+        return p == end;
+    }
+
+    /// 1-based line of the current position, for error messages.
+    unsigned int line () const {
+        unsigned int l = 1;
+        for (const char * c = begin; c < p && c < end; c++)
+            l += (*c == '\n');
+        return l;
+    }
+
+private:
+    /// Error message what, prefixed with the current line.
+    bool failed (const std::string & message, std::string & what) const {
+        what = std::to_string (line ()) + ": " + message;
+        return false;
+    }
+
+    const char * begin;
+    const char * p;
+    const char * end;
+};
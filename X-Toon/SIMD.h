@@ -0,0 +1,186 @@
+#pragma once
+// Minimal lane-parallel float type used by the CPU shading kernels.
+// vfloat maps to AVX2 (8 lanes), SSE2 (4 lanes) or a plain float (1 lane)
+// depending on the instruction set the translation unit is compiled for.
+// Every operation is a single IEEE operation per lane, so a kernel written
+// with vfloat gives the same result as the scalar code doing the same steps,
+// as long as neither is contracted into FMA (FPContract.h).
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define XTOON_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define XTOON_SIMD_SSE2
+#else
+#include <cmath>
+#define XTOON_SIMD_SCALAR
+#endif
+
+#if defined(XTOON_SIMD_AVX2)
+
+struct vmask {
+	__m256 m;
+	inline vmask(__m256 m) : m(m) {}
+};
+
+struct vfloat {
+	static const int width = 8;
+	__m256 v;
+	inline vfloat() {}
+	inline vfloat(__m256 v) : v(v) {}
+	inline vfloat(float s) : v(_mm256_set1_ps(s)) {}
+	static inline vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	inline void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline vfloat operator+ (vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator- (vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator* (vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/ (vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vmask operator< (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vmask operator> (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vmask operator== (vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+inline vmask operator& (vmask a, vmask b) { return _mm256_and_ps(a.m, b.m); }
+inline vmask operator| (vmask a, vmask b) { return _mm256_or_ps(a.m, b.m); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+// same operand order as std::min / std::max, NaNs included
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(b.v, a.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(b.v, a.v); }
+inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+// lane-wise (m ? a : b)
+inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+inline bool any(vmask m) { return _mm256_movemask_ps(m.m) != 0; }
+inline vfloat vfloor(vfloat a) { return _mm256_floor_ps(a.v); }
+// unbiased exponent and [1,2) mantissa of positive normal floats
+inline vfloat vexponent(vfloat a) {
+	__m256i e = _mm256_srli_epi32(_mm256_castps_si256(a.v), 23);
+	return _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(e, _mm256_set1_epi32(0xff)), _mm256_set1_epi32(127)));
+}
+inline vfloat vmantissa(vfloat a) {
+	__m256i m = _mm256_and_si256(_mm256_castps_si256(a.v), _mm256_set1_epi32(0x7fffff));
+	return _mm256_castsi256_ps(_mm256_or_si256(m, _mm256_set1_epi32(0x3f800000)));
+}
+// 2^n for integral n in [-126, 127]
+inline vfloat vexp2i(vfloat n) {
+	__m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+	return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+
+#elif defined(XTOON_SIMD_SSE2)
+
+struct vmask {
+	__m128 m;
+	inline vmask(__m128 m) : m(m) {}
+};
+
+struct vfloat {
+	static const int width = 4;
+	__m128 v;
+	inline vfloat() {}
+	inline vfloat(__m128 v) : v(v) {}
+	inline vfloat(float s) : v(_mm_set1_ps(s)) {}
+	static inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	inline void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline vfloat operator+ (vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator- (vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator* (vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/ (vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vmask operator< (vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vmask operator> (vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vmask operator== (vfloat a, vfloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline vmask operator& (vmask a, vmask b) { return _mm_and_ps(a.m, b.m); }
+inline vmask operator| (vmask a, vmask b) { return _mm_or_ps(a.m, b.m); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+// same operand order as std::min / std::max, NaNs included
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(b.v, a.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(b.v, a.v); }
+inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+// lane-wise (m ? a : b)
+inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+inline bool any(vmask m) { return _mm_movemask_ps(m.m) != 0; }
+// valid for |a| < 2^31, which covers every use in the kernels
+inline vfloat vfloor(vfloat a) {
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f)));
+}
+// unbiased exponent and [1,2) mantissa of positive normal floats
+inline vfloat vexponent(vfloat a) {
+	__m128i e = _mm_srli_epi32(_mm_castps_si128(a.v), 23);
+	return _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(e, _mm_set1_epi32(0xff)), _mm_set1_epi32(127)));
+}
+inline vfloat vmantissa(vfloat a) {
+	__m128i m = _mm_and_si128(_mm_castps_si128(a.v), _mm_set1_epi32(0x7fffff));
+	return _mm_castsi128_ps(_mm_or_si128(m, _mm_set1_epi32(0x3f800000)));
+}
+// 2^n for integral n in [-126, 127]
+inline vfloat vexp2i(vfloat n) {
+	__m128i e = _mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127));
+	return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+
+#else
+
+struct vmask {
+	bool m;
+	inline vmask(bool m) : m(m) {}
+};
+
+struct vfloat {
+	static const int width = 1;
+	float v;
+	inline vfloat() {}
+	inline vfloat(float s) : v(s) {}
+	static inline vfloat load(const float* p) { return *p; }
+	inline void store(float* p) const { *p = v; }
+};
+
+inline vfloat operator+ (vfloat a, vfloat b) { return a.v + b.v; }
+inline vfloat operator- (vfloat a, vfloat b) { return a.v - b.v; }
+inline vfloat operator* (vfloat a, vfloat b) { return a.v * b.v; }
+inline vfloat operator/ (vfloat a, vfloat b) { return a.v / b.v; }
+inline vmask operator< (vfloat a, vfloat b) { return a.v < b.v; }
+inline vmask operator> (vfloat a, vfloat b) { return a.v > b.v; }
+inline vmask operator== (vfloat a, vfloat b) { return a.v == b.v; }
+inline vmask operator& (vmask a, vmask b) { return a.m && b.m; }
+inline vmask operator| (vmask a, vmask b) { return a.m || b.m; }
+inline vfloat vsqrt(vfloat a) { return std::sqrt(a.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return b.v < a.v ? b.v : a.v; }
+inline vfloat vmax(vfloat a, vfloat b) { return a.v < b.v ? b.v : a.v; }
+inline vfloat vabs(vfloat a) { return std::fabs(a.v); }
+// lane-wise (m ? a : b)
+inline vfloat select(vmask m, vfloat a, vfloat b) { return m.m ? a : b; }
+inline bool any(vmask m) { return m.m; }
+inline vfloat vfloor(vfloat a) { return std::floor(a.v); }
+// unbiased exponent and [1,2) mantissa of positive normal floats
+inline vfloat vexponent(vfloat a) { int e; std::frexp(a.v, &e); return (float)(e - 1); }
+inline vfloat vmantissa(vfloat a) { int e; return 2.f * std::frexp(a.v, &e); }
+// 2^n for integral n in [-126, 127]
+inline vfloat vexp2i(vfloat n) { return std::ldexp(1.f, (int)n.v); }
+
+#endif
+
+// 3-vector of lanes, mirroring the Vec3 helpers the shading code uses
+struct vfloat3 {
+	vfloat x, y, z;
+	inline vfloat3() {}
+	inline vfloat3(vfloat x, vfloat y, vfloat z) : x(x), y(y), z(z) {}
+};
+
+inline vfloat3 operator+ (const vfloat3& a, const vfloat3& b) { return vfloat3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline vfloat3 operator- (const vfloat3& a, const vfloat3& b) { return vfloat3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline vfloat3 operator* (const vfloat3& a, vfloat s) { return vfloat3(a.x * s, a.y * s, a.z * s); }
+inline vfloat dot(const vfloat3& a, const vfloat3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline vfloat3 cross(const vfloat3& a, const vfloat3& b) {
+	return vfloat3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline vfloat length(const vfloat3& a) { return vsqrt(dot(a, a)); }
+// same steps as Vec3::normalize: zero vectors are left untouched
+inline vfloat3 normalize(const vfloat3& a) {
+	vfloat l = length(a);
+	vfloat invL = vfloat(1.f) / l;
+	vmask zero = l == vfloat(0.f);
+	return vfloat3(select(zero, a.x, a.x * invL), select(zero, a.y, a.y * invL), select(zero, a.z, a.z * invL));
+}
@@ -0,0 +1,380 @@
+#include "SoftRaster.h"
+#include <algorithm>
+#include <cmath>
+#include "EasyBMP/EasyBMP.h"
+#include "ThreadPool.h"
+#include "Meshlets.h"
+#include "MeshStream.h"
+
+using namespace std;
+
+namespace {
+	//twice the signed area of (a, b, p), positive when p is left of a->b (y up)
+	inline float edge(float ax, float ay, float bx, float by, float px, float py){
+		return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+	}
+	//pixels exactly on an edge belong to the triangle for top and left edges only;
+	//with counter-clockwise vertices and y up, left edges go down, top edges go left
+	inline bool topLeft(float ax, float ay, float bx, float by){
+		return by < ay || (by == ay && bx < ax);
+	}
+	inline unsigned char toByte(float c){
+		return (unsigned char)(min(max(c, 0.f), 1.f) * 255.f + 0.5f);
+	}
+
+	const unsigned int GRAIN = 4096;	//vertices or triangles per chunk of the parallel loops
+
+	//per-thread gather buffers of shade()
+	struct ShadeScratch {
+		VertexArrays span;
+		vector<float> rgb;
+		vector<unsigned int> pixel;
+	};
+	thread_local ShadeScratch scratch;
+}
+
+SoftRaster::SoftRaster(){
+	clearColor[0] = clearColor[1] = clearColor[2] = 0;
+}
+
+void SoftRaster::resize(unsigned int width, unsigned int height){
+	W = width;
+	H = height;
+	tilesX = (W + TILE - 1) >> TILE_SHIFT;
+	tilesY = (H + TILE - 1) >> TILE_SHIFT;
+	unsigned int padded = tilesX * tilesY * TILE * TILE;
+	color.resize(3 * W * H);
+	zbuffer.resize(padded);
+	visible.resize(padded);
+	bary.resize(2 * padded);
+	clear(full());
+}
+
+SoftRaster::Rect SoftRaster::tileRect(unsigned int tile) const {
+	int x0 = (tile % tilesX) << TILE_SHIFT, y0 = (tile / tilesX) << TILE_SHIFT;
+	Rect r = { x0, y0, min(x0 + TILE, (int)W), min(y0 + TILE, (int)H) };
+	return r;
+}
+
+void SoftRaster::setClearColor(const Vec3f& c){
+	for (int k = 0; k < 3; k++)
+		clearColor[k] = toByte(c[k]);
+}
+
+void SoftRaster::render(const Mesh& mesh, Camera& camera, XToon& xtoon, ThreadPool* pool, Meshlets* meshlets){
+	if (meshlets != nullptr)
+		meshlets->cull(camera, pool);
+	project(mesh, camera, pool);
+	xtoon.beginFrame();
+	bin(mesh, pool, meshlets);
+	forChunks(pool, tilesX * tilesY, 1, [&](unsigned int begin, unsigned int end){
+		for (unsigned int tile = begin; tile < end; tile++){
+			Rect r = tileRect(tile);
+			clear(r);
+			for (unsigned int k = binStart[tile]; k < binStart[tile + 1]; k++)
+				drawTriangle(mesh, binned[k], r);
+			shade(mesh, xtoon, r);
+		}
+	});
+}
+
+void SoftRaster::render(const MeshStream& stream, Camera& camera, XToon& xtoon, ThreadPool* pool){
+	xtoon.beginFrame();
+	clear(full());
+	Mesh chunk;
+	for (unsigned int first = 0; first < stream.numTriangles(); first += MeshStream::CHUNK){
+		stream.read(first, MeshStream::CHUNK, chunk);
+		project(chunk, camera, pool);
+		bin(chunk, pool, nullptr);
+		firstTriangle = first;
+		forChunks(pool, tilesX * tilesY, 1, [&](unsigned int begin, unsigned int end){
+			for (unsigned int tile = begin; tile < end; tile++){
+				Rect r = tileRect(tile);
+				for (unsigned int k = binStart[tile]; k < binStart[tile + 1]; k++)
+					drawTriangle(chunk, binned[k], r);
+			}
+		});
+	}
+	firstTriangle = 0;
+	const Vec3f* P = stream.positions();
+	const Vec3f* N = stream.normals();
+	const Triangle* T = stream.triangles();
+	forChunks(pool, tilesX * tilesY, 1, [&](unsigned int begin, unsigned int end){
+		for (unsigned int tile = begin; tile < end; tile++)
+			shadeCorners([&](unsigned int t, const Vec3f** p, const Vec3f** n){
+				for (int j = 0; j < 3; j++){
+					p[j] = &P[T[t].v[j]];
+					n[j] = &N[T[t].v[j]];
+				}
+			}, xtoon, tileRect(tile));
+	});
+}
+
+//tiles overlapped by the screen bounding box of a front-facing triangle,
+//with the same vertex positions and box as drawClipped
+SoftRaster::TileSpan SoftRaster::tileSpan(const Mesh& mesh, unsigned int t) const {
+	TileSpan none = { 0, 0, 0, 0 };
+	const Triangle& tri = mesh.T[t];
+	const ClipVertex* v[3] = { &clipped[tri.v[0]], &clipped[tri.v[1]], &clipped[tri.v[2]] };
+	//crossing the near plane : every tile, the clipping is done per tile
+	int x0 = 0, x1 = W, y0 = 0, y1 = H;
+	if (v[0]->z >= -v[0]->w && v[1]->z >= -v[1]->w && v[2]->z >= -v[2]->w){
+		float sx[3], sy[3];
+		for (int i = 0; i < 3; i++){
+			float iw = 1.f / v[i]->w;
+			sx[i] = (v[i]->x * iw * 0.5f + 0.5f) * W;
+			sy[i] = (v[i]->y * iw * 0.5f + 0.5f) * H;
+		}
+		if (!(edge(sx[0], sy[0], sx[1], sy[1], sx[2], sy[2]) > 0.f))
+			return none;
+		x0 = (int)max(0.f, floor(min(min(sx[0], sx[1]), sx[2])));
+		x1 = (int)min((float)W, ceil(max(max(sx[0], sx[1]), sx[2])) + 1.f);
+		y0 = (int)max(0.f, floor(min(min(sy[0], sy[1]), sy[2])));
+		y1 = (int)min((float)H, ceil(max(max(sy[0], sy[1]), sy[2])) + 1.f);
+		if (x1 <= x0 || y1 <= y0)
+			return none;
+	}
+	TileSpan s = { (unsigned short)(x0 >> TILE_SHIFT), (unsigned short)(y0 >> TILE_SHIFT),
+		(unsigned short)(((x1 - 1) >> TILE_SHIFT) + 1), (unsigned short)(((y1 - 1) >> TILE_SHIFT) + 1) };
+	return s;
+}
+
+//two passes over the same triangle chunks: count per tile, then fill, the
+//offsets being laid out tile by tile and chunk by chunk in each tile so that
+//every bin lists its triangles in mesh order, as the serial drawing would;
+//the triangles of culled meshlets get an empty span
+void SoftRaster::bin(const Mesh& mesh, ThreadPool* pool, const Meshlets* meshlets){
+	unsigned int numTiles = tilesX * tilesY, numTriangles = mesh.T.size();
+	unsigned int numChunks = (numTriangles + GRAIN - 1) / GRAIN;
+	spans.resize(numTriangles);
+	binCounts.assign(numChunks * numTiles, 0);
+	forChunks(pool, numTriangles, GRAIN, [&](unsigned int begin, unsigned int end){
+		unsigned int* counts = &binCounts[begin / GRAIN * numTiles];
+		for (unsigned int t = begin; t < end; t++){
+			TileSpan none = { 0, 0, 0, 0 };
+			bool culled = meshlets != nullptr && !meshlets->visible(meshlets->meshletOf(t));
+			TileSpan s = spans[t] = culled ? none : tileSpan(mesh, t);
+			for (unsigned int ty = s.ty0; ty < s.ty1; ty++)
+				for (unsigned int tx = s.tx0; tx < s.tx1; tx++)
+					counts[ty * tilesX + tx]++;
+		}
+	});
+	binStart.resize(numTiles + 1);
+	unsigned int total = 0;
+	for (unsigned int tile = 0; tile < numTiles; tile++){
+		binStart[tile] = total;
+		for (unsigned int c = 0; c < numChunks; c++){
+			unsigned int n = binCounts[c * numTiles + tile];
+			binCounts[c * numTiles + tile] = total;
+			total += n;
+		}
+	}
+	binStart[numTiles] = total;
+	binned.resize(total);
+	forChunks(pool, numTriangles, GRAIN, [&](unsigned int begin, unsigned int end){
+		unsigned int* offsets = &binCounts[begin / GRAIN * numTiles];
+		for (unsigned int t = begin; t < end; t++){
+			const TileSpan& s = spans[t];
+			for (unsigned int ty = s.ty0; ty < s.ty1; ty++)
+				for (unsigned int tx = s.tx0; tx < s.tx1; tx++)
+					binned[offsets[ty * tilesX + tx]++] = t;
+		}
+	});
+}
+
+void SoftRaster::clear(const Rect& r){
+	for (int y = r.y0; y < r.y1; y++)
+		for (int x = r.x0; x < r.x1; x++){
+			unsigned char* c = &color[3 * (y * W + x)];
+			c[0] = clearColor[0];
+			c[1] = clearColor[1];
+			c[2] = clearColor[2];
+			unsigned int i = index(x, y);
+			zbuffer[i] = 1.f;
+			visible[i] = NO_TRIANGLE;
+		}
+}
+
+//eye space as in Camera::apply, then the gluPerspective matrix of Camera::resize
+void SoftRaster::project(const Mesh& mesh, Camera& camera, ThreadPool* pool){
+	const CameraState& s = camera.state();
+	double n = camera.getNearPlane(), f = camera.getFarPlane();
+	float sy = (float)(1. / tan(camera.getFovAngle() * 3.14159265358979323846 / 360.));
+	float sx = sy / camera.getAspectRatio();
+	float zz = (float)((f + n) / (n - f)), zw = (float)(2. * f * n / (n - f));
+	clipped.resize(mesh.V.size());
+	forChunks(pool, mesh.V.size(), GRAIN, [&](unsigned int begin, unsigned int end){
+		for (unsigned int i = begin; i < end; i++){
+			Vec3f e = s.toEye(mesh.V[i].p);
+			ClipVertex& c = clipped[i];
+			c.x = sx * e[0];
+			c.y = sy * e[1];
+			c.z = zz * e[2] + zw;
+			c.w = -e[2];
+		}
+	});
+}
+
+void SoftRaster::rasterize(const Mesh& mesh, unsigned int first, unsigned int count, const Rect& r){
+	unsigned int last = min(first + count, (unsigned int)mesh.T.size());
+	for (unsigned int t = first; t < last; t++)
+		drawTriangle(mesh, t, r);
+}
+
+void SoftRaster::drawTriangle(const Mesh& mesh, unsigned int t, const Rect& r){
+	const Triangle& tri = mesh.T[t];
+	ClipVertex v[3] = { clipped[tri.v[0]], clipped[tri.v[1]], clipped[tri.v[2]] };
+	v[0].b1 = 0.f; v[0].b2 = 0.f;
+	v[1].b1 = 1.f; v[1].b2 = 0.f;
+	v[2].b1 = 0.f; v[2].b2 = 1.f;
+	clipTriangle(firstTriangle + t, v, r);
+}
+
+//clip against the near plane (z >= -w) when needed, the other planes are
+//handled by the screen rectangle and the depth range
+void SoftRaster::clipTriangle(unsigned int t, const ClipVertex* v, const Rect& r){
+	//whole triangle outside one of the frustum planes
+	if ((v[0].x > v[0].w && v[1].x > v[1].w && v[2].x > v[2].w) ||
+		(v[0].x < -v[0].w && v[1].x < -v[1].w && v[2].x < -v[2].w) ||
+		(v[0].y > v[0].w && v[1].y > v[1].w && v[2].y > v[2].w) ||
+		(v[0].y < -v[0].w && v[1].y < -v[1].w && v[2].y < -v[2].w) ||
+		(v[0].z > v[0].w && v[1].z > v[1].w && v[2].z > v[2].w) ||
+		(v[0].z < -v[0].w && v[1].z < -v[1].w && v[2].z < -v[2].w))
+		return;
+	if (v[0].z >= -v[0].w && v[1].z >= -v[1].w && v[2].z >= -v[2].w){
+		drawClipped(t, v[0], v[1], v[2], r);
+		return;
+	}
+	ClipVertex poly[4];
+	int n = 0;
+	for (int i = 0; i < 3; i++){
+		const ClipVertex& a = v[i];
+		const ClipVertex& b = v[(i + 1) % 3];
+		float da = a.z + a.w, db = b.z + b.w;
+		if (da >= 0)
+			poly[n++] = a;
+		if ((da >= 0) != (db >= 0)){
+			float s = da / (da - db);
+			ClipVertex& c = poly[n++];
+			c.x = a.x + s * (b.x - a.x);
+			c.y = a.y + s * (b.y - a.y);
+			c.z = a.z + s * (b.z - a.z);
+			c.w = a.w + s * (b.w - a.w);
+			c.b1 = a.b1 + s * (b.b1 - a.b1);
+			c.b2 = a.b2 + s * (b.b2 - a.b2);
+		}
+	}
+	for (int i = 1; i + 1 < n; i++)
+		drawClipped(t, poly[0], poly[i], poly[i + 1], r);
+}
+
+void SoftRaster::drawClipped(unsigned int t, const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, const Rect& r){
+	const ClipVertex* v[3] = { &a, &b, &c };
+	float sx[3], sy[3], sz[3], iw[3];
+	for (int i = 0; i < 3; i++){
+		iw[i] = 1.f / v[i]->w;
+		sx[i] = (v[i]->x * iw[i] * 0.5f + 0.5f) * W;
+		sy[i] = (v[i]->y * iw[i] * 0.5f + 0.5f) * H;
+		sz[i] = v[i]->z * iw[i] * 0.5f + 0.5f;
+	}
+	float area = edge(sx[0], sy[0], sx[1], sy[1], sx[2], sy[2]);
+	if (!(area > 0.f))	//back facing, degenerate or NaN
+		return;
+
+	//bounding box clamped in float first, off-screen vertices can be far outside the int range
+	int x0 = (int)max((float)r.x0, floor(min(min(sx[0], sx[1]), sx[2])));
+	int x1 = (int)min((float)r.x1, ceil(max(max(sx[0], sx[1]), sx[2])) + 1.f);
+	int y0 = (int)max((float)r.y0, floor(min(min(sy[0], sy[1]), sy[2])));
+	int y1 = (int)min((float)r.y1, ceil(max(max(sy[0], sy[1]), sy[2])) + 1.f);
+	bool tl0 = topLeft(sx[1], sy[1], sx[2], sy[2]);
+	bool tl1 = topLeft(sx[2], sy[2], sx[0], sy[0]);
+	bool tl2 = topLeft(sx[0], sy[0], sx[1], sy[1]);
+	float invArea = 1.f / area;
+
+	for (int y = y0; y < y1; y++){
+		float py = y + 0.5f;
+		for (int x = x0; x < x1; x++){
+			float px = x + 0.5f;
+			float e0 = edge(sx[1], sy[1], sx[2], sy[2], px, py);
+			float e1 = edge(sx[2], sy[2], sx[0], sy[0], px, py);
+			float e2 = edge(sx[0], sy[0], sx[1], sy[1], px, py);
+			if (!(e0 > 0 || (e0 == 0 && tl0)) || !(e1 > 0 || (e1 == 0 && tl1)) || !(e2 > 0 || (e2 == 0 && tl2)))
+				continue;
+			float l0 = e0 * invArea, l1 = e1 * invArea, l2 = e2 * invArea;
+			float z = l0 * sz[0] + l1 * sz[1] + l2 * sz[2];
+			unsigned int i = index(x, y);
+			if (!(z < zbuffer[i]) || z < 0.f)
+				continue;
+			//perspective-correct barycentrics of the source triangle
+			float q0 = l0 * iw[0], q1 = l1 * iw[1], q2 = l2 * iw[2];
+			float iq = 1.f / (q0 + q1 + q2);
+			zbuffer[i] = z;
+			visible[i] = t;
+			bary[2 * i] = (q0 * a.b1 + q1 * b.b1 + q2 * c.b1) * iq;
+			bary[2 * i + 1] = (q0 * a.b2 + q1 * b.b2 + q2 * c.b2) * iq;
+		}
+	}
+}
+
+void SoftRaster::shade(const Mesh& mesh, XToon& xtoon, const Rect& r){
+	shadeCorners([&](unsigned int t, const Vec3f** p, const Vec3f** n){
+		for (int j = 0; j < 3; j++){
+			p[j] = &mesh.V[mesh.T[t].v[j]].p;
+			n[j] = &mesh.V[mesh.T[t].v[j]].n;
+		}
+	}, xtoon, r);
+}
+
+//interpolated position and normal of the visible pixels, shaded in one batch;
+//corners(t, p, n) points p and n to the positions and normals of the corners of triangle t
+template <class Corners>
+void SoftRaster::shadeCorners(const Corners& corners, XToon& xtoon, const Rect& r){
+	ShadeScratch& g = scratch;
+	unsigned int size = max(r.x1 - r.x0, 0) * max(r.y1 - r.y0, 0);
+	if (g.pixel.size() < size){
+		g.span.px.resize(size); g.span.py.resize(size); g.span.pz.resize(size);
+		g.span.nx.resize(size); g.span.ny.resize(size); g.span.nz.resize(size);
+		g.rgb.resize(3 * size);
+		g.pixel.resize(size);
+	}
+	unsigned int count = 0;
+	for (int y = r.y0; y < r.y1; y++)
+		for (int x = r.x0; x < r.x1; x++){
+			unsigned int i = index(x, y);
+			if (visible[i] == NO_TRIANGLE)
+				continue;
+			const Vec3f* cp[3];
+			const Vec3f* cn[3];
+			corners(visible[i], cp, cn);
+			float b1 = bary[2 * i], b2 = bary[2 * i + 1], b0 = 1.f - b1 - b2;
+			Vec3f p = b0 * *cp[0] + b1 * *cp[1] + b2 * *cp[2];
+			Vec3f n = b0 * *cn[0] + b1 * *cn[1] + b2 * *cn[2];
+			n.normalize();
+			g.span.px[count] = p[0]; g.span.py[count] = p[1]; g.span.pz[count] = p[2];
+			g.span.nx[count] = n[0]; g.span.ny[count] = n[1]; g.span.nz[count] = n[2];
+			g.pixel[count] = 3 * (y * W + x);
+			count++;
+		}
+	if (count == 0)
+		return;
+	xtoon.getBatch(count, &g.span.px[0], &g.span.py[0], &g.span.pz[0],
+		&g.span.nx[0], &g.span.ny[0], &g.span.nz[0], &g.rgb[0]);
+	for (unsigned int k = 0; k < count; k++)
+		for (int c = 0; c < 3; c++)
+			color[g.pixel[k] + c] = toByte(g.rgb[3 * k + c]);
+}
+
+bool SoftRaster::writeBMP(const std::string& filename) const {
+	BMP out;
+	out.SetBitDepth(24);
+	out.SetSize(W, H);
+	for (unsigned int y = 0; y < H; y++)
+		for (unsigned int x = 0; x < W; x++){
+			const unsigned char* c = &color[3 * (y * W + x)];
+			RGBApixel* p = out(x, H - 1 - y);
+			p->Red = c[0];
+			p->Green = c[1];
+			p->Blue = c[2];
+		}
+	return out.WriteToFile(filename.c_str());
+}
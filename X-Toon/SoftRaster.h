@@ -0,0 +1,118 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Camera.h"
+#include "XToon.h"
+
+class ThreadPool;
+class Meshlets;
+class MeshStream;
+
+/// CPU rasterizer producing X-Toon images without OpenGL.
+/// Follows the GL path of the viewer: the camera projection (gluPerspective
+/// and Camera::apply), GL_LESS z-buffer, back faces culled with counter-
+/// clockwise front faces, pixel centres sampled with a top-left fill rule.
+/// Triangles are resolved first into a visibility buffer (depth, triangle,
+/// perspective-correct barycentrics); the visible pixels are then shaded
+/// once each, per pixel like the fragment shaders, through XToon::getBatch.
+///
+/// The screen is cut into TILE x TILE tiles. render() bins the triangles
+/// into the tiles they overlap, then rasterizes and shades the tiles in
+/// parallel. The visibility buffer is stored tile by tile (64 KB per tile,
+/// so a tile being worked on stays in L2), and every tile writes its own
+/// block of the colour buffer, so no locking is needed. Pixel coverage is
+/// computed from the pixel position only, so the image does not depend on
+/// the tile size or on the thread count.
+class SoftRaster {
+public:
+	/// Pixel rectangle [x0, x1) x [y0, y1), y going up as in GL window coordinates.
+	struct Rect {
+		int x0, y0, x1, y1;
+	};
+	static const unsigned int NO_TRIANGLE = 0xffffffff;
+	static const int TILE_SHIFT = 6;
+	static const int TILE = 1 << TILE_SHIFT;
+
+	SoftRaster();
+
+	//framebuffer size in pixels
+	void resize(unsigned int width, unsigned int height);
+	inline unsigned int width() const { return W; }
+	inline unsigned int height() const { return H; }
+	inline Rect full() const { Rect r = { 0, 0, (int)W, (int)H }; return r; }
+	void setClearColor(const Vec3f& c);
+
+	//draw the whole mesh; xtoon must be set for one of its CPU modes (enableShader = false)
+	//--  the tiles are split across the pool when one is given
+	//--  with the meshlets of mesh, the back-facing and off-screen ones are culled first and
+	//    their triangles not binned
+	void render(const Mesh& mesh, Camera& camera, XToon& xtoon, ThreadPool* pool = nullptr, Meshlets* meshlets = nullptr);
+	//draw a mesh larger than memory: its chunks are projected, binned and rasterized one
+	//after the other, then the visible pixels are shaded from the stream; the memory used
+	//is that of the framebuffer and of one chunk, whatever the size of the mesh
+	void render(const MeshStream& stream, Camera& camera, XToon& xtoon, ThreadPool* pool = nullptr);
+
+	//the steps of render(), usable on part of the frame or of the mesh
+	//--  reset colour, depth and visibility inside r
+	void clear(const Rect& r);
+	//--  transform the mesh vertices to clip space, once per frame
+	void project(const Mesh& mesh, Camera& camera, ThreadPool* pool = nullptr);
+	//--  z-test triangles [first, first + count) inside r, can be called for successive chunks
+	void rasterize(const Mesh& mesh, unsigned int first, unsigned int count, const Rect& r);
+	//--  shade the visible pixels of r
+	void shade(const Mesh& mesh, XToon& xtoon, const Rect& r);
+
+	//rgb bytes, bottom row first (glReadPixels order)
+	inline const unsigned char* pixels() const { return &color[0]; }
+	//window depth in 0..1, 1 where nothing was drawn
+	inline float depth(int x, int y) const { return zbuffer[index(x, y)]; }
+	//triangle seen at a pixel, NO_TRIANGLE for the background
+	inline unsigned int triangle(int x, int y) const { return visible[index(x, y)]; }
+
+	//24-bit BMP of the framebuffer
+	bool writeBMP(const std::string& filename) const;
+
+private:
+	//clip-space position and barycentric coordinates in the source triangle
+	struct ClipVertex {
+		float x, y, z, w;
+		float b1, b2;
+	};
+	//tiles overlapped by a triangle, [tx0, tx1) x [ty0, ty1), empty when culled
+	struct TileSpan {
+		unsigned short tx0, ty0, tx1, ty1;
+	};
+
+	unsigned int W = 0, H = 0;
+	unsigned int tilesX = 0, tilesY = 0;
+	unsigned char clearColor[3];
+	std::vector<unsigned char> color;	//row-major
+	std::vector<float> zbuffer;			//tile-major, see index()
+	std::vector<unsigned int> visible;
+	std::vector<float> bary;			//b1, b2 per pixel, b0 = 1 - b1 - b2
+	std::vector<ClipVertex> clipped;	//projected mesh vertices
+	unsigned int firstTriangle = 0;		//index in the stream of triangle 0 of the chunk drawn
+
+	//bins: the triangles of tile i are binned[binStart[i] .. binStart[i + 1]), in mesh order
+	std::vector<TileSpan> spans;
+	std::vector<unsigned int> binCounts;	//per triangle chunk and tile
+	std::vector<unsigned int> binStart;
+	std::vector<unsigned int> binned;
+
+	//tile-major pixel index: tiles in rows, pixels in rows inside a tile
+	inline unsigned int index(int x, int y) const {
+		return (((y >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT)) << (2 * TILE_SHIFT))
+			+ ((y & (TILE - 1)) << TILE_SHIFT) + (x & (TILE - 1));
+	}
+	Rect tileRect(unsigned int tile) const;
+
+	void bin(const Mesh& mesh, ThreadPool* pool, const Meshlets* meshlets);
+	TileSpan tileSpan(const Mesh& mesh, unsigned int t) const;
+	void drawTriangle(const Mesh& mesh, unsigned int t, const Rect& r);
+	void clipTriangle(unsigned int t, const ClipVertex* v, const Rect& r);
+	void drawClipped(unsigned int t, const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, const Rect& r);
+	template <class Corners>
+	void shadeCorners(const Corners& corners, XToon& xtoon, const Rect& r);
+};
@@ -0,0 +1,158 @@
+#include "ThreadPool.h"
+#include <cstdlib>
+
+using namespace std;
+
+namespace {
+	inline unsigned long long packRange(unsigned int begin, unsigned int end){
+		return ((unsigned long long)begin << 32) | end;
+	}
+}
+
+ThreadPool::ThreadPool(unsigned int numThreads){
+	start(numThreads);
+}
+
+ThreadPool::~ThreadPool(){
+	stop();
+}
+
+void ThreadPool::setThreads(unsigned int numThreads){
+	stop();
+	start(numThreads);
+}
+
+void ThreadPool::start(unsigned int numThreads){
+	if (numThreads == 0)
+		numThreads = max(1u, thread::hardware_concurrency());
+	quit = false;
+	runs.reset(new Run[numThreads]);
+	for (unsigned int i = 0; i < numThreads; i++)
+		runs[i].range = 0;
+	//participant 0 is the thread calling parallelFor
+	for (unsigned int i = 1; i < numThreads; i++)
+		workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+}
+
+void ThreadPool::stop(){
+	{
+		lock_guard<mutex> lock(guard);
+		quit = true;
+	}
+	wake.notify_all();
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+}
+
+void ThreadPool::workerLoop(unsigned int id){
+	unsigned long long seen = 0;
+	for (;;){
+		{
+			unique_lock<mutex> lock(guard);
+			wake.wait(lock, [&]{ return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+		}
+		runChunks(id);
+		{
+			lock_guard<mutex> lock(guard);
+			pending--;
+		}
+		done.notify_one();
+	}
+}
+
+bool ThreadPool::popFront(unsigned int id, unsigned int& chunk){
+	atomic<unsigned long long>& r = runs[id].range;
+	unsigned long long v = r.load();
+	for (;;){
+		unsigned int begin = (unsigned int)(v >> 32), end = (unsigned int)v;
+		if (begin >= end)
+			return false;
+		if (r.compare_exchange_weak(v, packRange(begin + 1, end))){
+			chunk = begin;
+			return true;
+		}
+	}
+}
+
+bool ThreadPool::stealBack(unsigned int id, unsigned int& chunk){
+	atomic<unsigned long long>& r = runs[id].range;
+	unsigned long long v = r.load();
+	for (;;){
+		unsigned int begin = (unsigned int)(v >> 32), end = (unsigned int)v;
+		if (begin >= end)
+			return false;
+		if (r.compare_exchange_weak(v, packRange(begin, end - 1))){
+			chunk = end - 1;
+			return true;
+		}
+	}
+}
+
+void ThreadPool::runChunks(unsigned int id){
+	unsigned int n = size(), chunk;
+	for (;;){
+		bool found = popFront(id, chunk);
+		for (unsigned int k = 1; !found && k < n; k++)
+			found = stealBack((id + k) % n, chunk);
+		if (!found)
+			return;
+		unsigned int begin = chunk * jobGrain;
+		(*job)(begin, min(begin + jobGrain, jobCount));
+	}
+}
+
+void ThreadPool::parallelFor(unsigned int count, unsigned int grain, const RangeFunc& fn){
+	if (count == 0)
+		return;
+	if (grain == 0)
+		grain = 1;
+	unsigned int numChunks = (count + grain - 1) / grain;
+	//exchange last: it is only taken when the loop goes to the workers, and released below
+	if (workers.empty() || numChunks == 1 || busy.exchange(true, memory_order_acquire)){
+		for (unsigned int begin = 0; begin < count; begin += grain)
+			fn(begin, min(begin + grain, count));
+		return;
+	}
+	unsigned int n = size();
+	for (unsigned int i = 0; i < n; i++)
+		runs[i].range = packRange((unsigned int)((unsigned long long)numChunks * i / n),
+			(unsigned int)((unsigned long long)numChunks * (i + 1) / n));
+	job = &fn;
+	jobCount = count;
+	jobGrain = grain;
+	{
+		lock_guard<mutex> lock(guard);
+		pending = (unsigned int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+	runChunks(0);
+	unique_lock<mutex> lock(guard);
+	done.wait(lock, [&]{ return pending == 0; });
+	job = nullptr;
+	busy.store(false, memory_order_release);
+}
+
+unsigned int ThreadPool::alignedGrain(unsigned int grain, unsigned int itemBytes){
+	//smallest item count spanning a whole number of cache lines
+	unsigned int a = 64, b = itemBytes;
+	while (b != 0){
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	unsigned int step = 64 / a;
+	return max(step, (grain + step - 1) / step * step);
+}
+
+ThreadPool& ThreadPool::global(){
+	static ThreadPool pool([]{
+		const char* env = getenv("XTOON_THREADS");
+		return env != nullptr ? (unsigned int)atoi(env) : 0u;
+	}());
+	return pool;
+}
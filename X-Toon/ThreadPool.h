@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Persistent pool of worker threads running parallel loops.
+/// A loop over [0, count) is cut into chunks; every participant (the workers
+/// and the calling thread) starts on its own contiguous run of chunks and,
+/// once it is empty, steals chunks from the tail of the others' runs.
+/// With a single thread the chunks are run in order on the caller, which
+/// gives a deterministic reference for regression comparison.
+/// The pool runs one loop at a time. A parallelFor called while another is in flight,
+/// from inside its fn or from another thread, runs its chunks in order on its caller
+/// instead of waiting, so nested loops and two submitters on global() are safe but do
+/// not share the workers. setThreads and the destructor must not overlap a loop.
+class ThreadPool {
+public:
+	typedef std::function<void(unsigned int begin, unsigned int end)> RangeFunc;
+
+	//numThreads counts the calling thread; 0 = one per hardware thread
+	explicit ThreadPool(unsigned int numThreads = 0);
+	~ThreadPool();
+
+	//restart the pool with another thread count (0 = hardware concurrency)
+	void setThreads(unsigned int numThreads);
+	inline unsigned int size() const { return (unsigned int)workers.size() + 1; }
+
+	//run fn on chunks of about grain items covering [0, count), and wait for completion;
+	//on the calling thread alone when the pool is already running a loop
+	void parallelFor(unsigned int count, unsigned int grain, const RangeFunc& fn);
+
+	//deterministic reduction: chunk results are combined in chunk order whatever the thread count
+	template <class T, class ChunkFunc, class Combine>
+	T parallelReduce(unsigned int count, unsigned int grain, T init, ChunkFunc chunk, Combine combine);
+
+	//round grain up so that chunk boundaries fall on 64-byte cache lines of an array of itemBytes-sized items
+	static unsigned int alignedGrain(unsigned int grain, unsigned int itemBytes);
+
+	//shared pool; its size is read once from the XTOON_THREADS environment variable if set
+	static ThreadPool& global();
+
+private:
+	struct alignas(64) Run {
+		std::atomic<unsigned long long> range; //chunk interval, begin << 32 | end
+	};
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<Run[]> runs;
+	std::mutex guard;
+	std::condition_variable wake, done;
+	unsigned long long generation = 0;
+	unsigned int pending = 0;
+	bool quit = false;
+
+	std::atomic<bool> busy{false};	//a loop is in flight, taken by its submitter
+	const RangeFunc* job = nullptr;
+	unsigned int jobCount = 0, jobGrain = 0;
+
+	void start(unsigned int numThreads);
+	void stop();
+	void workerLoop(unsigned int id);
+	void runChunks(unsigned int id);
+	bool popFront(unsigned int id, unsigned int& chunk);
+	bool stealBack(unsigned int id, unsigned int& chunk);
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+};
+
+//pool->parallelFor, or the same chunks in order on the calling thread without a pool
+template <class Func>
+void forChunks(ThreadPool* pool, unsigned int count, unsigned int grain, const Func& fn){
+	if (pool != nullptr)
+		pool->parallelFor(count, grain, fn);
+	else
+		for (unsigned int begin = 0; begin < count; begin += grain)
+			fn(begin, begin + grain < count ? begin + grain : count);
+}
+
+template <class T, class ChunkFunc, class Combine>
+T ThreadPool::parallelReduce(unsigned int count, unsigned int grain, T init, ChunkFunc chunk, Combine combine){
+	if (grain == 0)
+		grain = 1;
+	unsigned int numChunks = (count + grain - 1) / grain;
+	std::vector<T> partial(numChunks, init);
+	parallelFor(count, grain, [&](unsigned int begin, unsigned int end){
+		partial[begin / grain] = chunk(begin, end);
+	});
+	T result = init;
+	for (unsigned int i = 0; i < numChunks; i++)
+		result = combine(result, partial[i]);
+	return result;
+}
@@ -0,0 +1,33 @@
+#include "ToonLUT.h"
+#include <algorithm>
+
+using namespace std;
+
+ToonLUT::ToonLUT() : table(new Table()) {}
+
+void ToonLUT::build(BMP& bmp){
+	for (int row = 0; row < SIZE; row++)
+		for (int col = 0; col < SIZE; col++){
+			RGBApixel* p = bmp(col, row);
+			float* t = table->rgb + 3 * (row * SIZE + col);
+			t[0] = p->Red / 255.f;
+			t[1] = p->Green / 255.f;
+			t[2] = p->Blue / 255.f;
+			table->rgba8[row * SIZE + col] = p->Red | (p->Green << 8) | (p->Blue << 16) | (255u << 24);
+		}
+}
+
+//texel centres are at (k + 0.5) / SIZE
+void ToonLUT::sampleBilinear(float dim1, float dim2, float* out) const {
+	float u = min(max(dim1 * SIZE - 0.5f, 0.f), SIZE - 1.f);
+	float v = min(max(dim2 * SIZE - 0.5f, 0.f), SIZE - 1.f);
+	int c0 = (int)u, r0 = (int)v;
+	int c1 = min(c0 + 1, SIZE - 1), r1 = min(r0 + 1, SIZE - 1);
+	float fu = u - c0, fv = v - r0;
+	const float *t00 = rgb(r0, c0), *t01 = rgb(r0, c1), *t10 = rgb(r1, c0), *t11 = rgb(r1, c1);
+	for (int k = 0; k < 3; k++){
+		float top = t00[k] + (t01[k] - t00[k]) * fu;
+		float bottom = t10[k] + (t11[k] - t10[k]) * fu;
+		out[k] = top + (bottom - top) * fv;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include "EasyBMP/EasyBMP.h"
+#include "Vec3.h"
+
+/// 256x256 X-Toon texture converted once for CPU sampling.
+/// Rows follow the detail value (dim2), columns the tone (dim1), both stored
+/// row-major and 64-byte aligned: float rgb in 0..1 for shading, and packed
+/// RGBA8 (r | g << 8 | b << 16 | a << 24) for byte outputs.
+class ToonLUT {
+public:
+	static const int SIZE = 256;
+
+	ToonLUT();
+
+	//convert a 256x256 bitmap (x = dim1, y = dim2)
+	void build(BMP& bmp);
+
+	//texel index of a value in 0..1, clamped, without branches
+	static inline int index(float dim){
+		return (int)(std::min(std::max(dim, 0.f), 1.f) * (256. - 0.000000001));
+	}
+
+	inline const float* rgb(int row, int col) const { return table->rgb + 3 * (row * SIZE + col); }
+	inline unsigned int rgba8(int row, int col) const { return table->rgba8[row * SIZE + col]; }
+
+	//nearest texel of (dim1, dim2), written to out[0..2]
+	inline void sample(float dim1, float dim2, float* out) const {
+		const float* t = rgb(index(dim2), index(dim1));
+		out[0] = t[0];
+		out[1] = t[1];
+		out[2] = t[2];
+	}
+	//bilinear filtering between texel centres, clamped to the edge texels
+	void sampleBilinear(float dim1, float dim2, float* out) const;
+
+private:
+	struct alignas(64) Table {
+		float rgb[3 * SIZE * SIZE];
+		unsigned int rgba8[SIZE * SIZE];
+	};
+	std::unique_ptr<Table> table;
+};
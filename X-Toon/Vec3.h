@@ -22,6 +22,7 @@
 #include <iostream>
 
 /// Vector in 3 dimensions, with basics operators overloaded.
+/// Copies are the implicit ones, so Vec3 of a scalar type is trivially copyable.
 template <class T>
 class Vec3 {
 
@@ -34,12 +35,6 @@ public:
 	p[2] = p2; 
   };
 
-  inline Vec3 (const Vec3 & v) {
-	init (v[0], v[1], v[2]);
-  }
-  
-  ~Vec3() {}
-
   inline Vec3 (T* pp) { 
 	p[0] = pp[0];
 	p[1] = pp[1];
@@ -58,13 +53,6 @@ public:
 	return (p[Index]);
   };
 
-  inline Vec3& operator= (const Vec3 & P) {
-	p[0] = P[0];
-	p[1] = P[1];
-	p[2] = P[2];
-	return (*this);
-  };
-
   inline Vec3& operator+= (const Vec3 & P) {
 	p[0] += P[0];
 	p[1] += P[1];
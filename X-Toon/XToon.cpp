@@ -1,4 +1,6 @@
-﻿#include "XToon.h"
+﻿#include "FPContract.h"
+#include "XToon.h"
+#include "FastMath.h"
 #include <cmath>
 
 using namespace std;
@@ -14,38 +16,33 @@ XToon::XToon(const std::string& textureFileName, const Vec3f& lightpos, Camera*
 		cout << texture.TellWidth() << " " << texture.TellHeight() << endl;
 		texture.SetSize(256, 256);
 	}
+	lut.build(texture);
 	this->light = lightpos;
 	this->camera = c;
 }
 
 Vec3f XToon::lightPos(){
-	return camera->getV(light);
+	frame();
+	return viewLight;
 }
 
 void XToon::lightPos(const Vec3f& l){
 	light = l;
+	viewDirty = true;
 	if (glprog != nullptr)
-		glprog->setUniform3f("light", light[0], light[1], light[2]);
+		glprog->set(uniforms.light, light[0], light[1], light[2]);
 }
 
-//initialize program with vertex and fragment shader and load texture
-bool XToon::initProgram(const string& vert, const string& frag){
-	try {
-		BMPtexture.ImportBMP(texture);
-		glGenTextures(1, &texName); // Génération d’une texture OpenGL
-		glBindTexture(GL_TEXTURE_2D, texName); // Activation de la texture comme texture courante
-		// les 4 lignes suivantes paramètre le filtrage de texture ainsi que sa répétition au-delà du carré unitaire
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		// La commande suivante remplit la texture (sur GPU) avec les données de l’image
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, BMPtexture.TellWidth(), BMPtexture.TellHeight(),0, GL_RGB, GL_UNSIGNED_BYTE, BMPtexture.Texture);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texName);
-		glprog = Program::genVFProgram("Simple GL Program", vert, frag);
-		glprog->setUniform1i("texsample", 0);
+//build the programs of the math variant approxOK on first use, then bind the one of mode
+//unless it is bound already; a shader error is reported to XToon_shader_error_log.txt, and
+//not retried before the next setFor*
+bool XToon::useProgram(XToonPrograms::Mode mode){
+	if (glFailed)
+		return false;
+	if (glprog != nullptr && glApprox == approxOK)
 		return true;
+	try {
+		programs.build(texture, approxOK);
 	}
 	catch (Exception & e) {
 		ofstream myfile;
@@ -53,28 +50,47 @@ bool XToon::initProgram(const string& vert, const string& frag){
 		cerr << e.msg() << endl;
 		myfile << e.msg() << endl;
 		myfile.close();
+		glprog = nullptr;
+		glFailed = true;
 		return false;
 	}
+	const XToonPrograms::Variant& v = programs.bind(mode, approxOK);
+	glprog = v.program;
+	glApprox = approxOK;
+	uniforms = v.uniforms;
+	glprog->set(uniforms.light, light[0], light[1], light[2]);
+	return true;
 }
 
 XToon::~XToon(){}
 
+//refresh the snapshot only when the camera or the light moved
+const CameraState& XToon::frame(){
+	const CameraState& s = camera->state();
+	if (viewDirty || s.stamp != view.stamp){
+		view = s;
+		viewLight = view.getV(light);
+		viewDirty = false;
+	}
+	return view;
+}
+
+void XToon::beginFrame(){
+	frame();
+}
+
 //D = 1−log(z/zmin)/log(zmax/zmin)
 void XToon::setForDepth(float* zmin, float* zmax, bool enableShader){
 	this->_zmax = zmax;
 	this->_zmin = zmin;
-	this->zmin = *_zmin;
-	this->zmax = *_zmax;
 	if (enableShader){
-		initProgram("shader.vert","XToon_depth.frag");
-		glprog->setUniform1f("zmin", this->zmin);
-		glprog->setUniform1f("zmax", this->zmax);
-		glprog->setUniform3f("light", light[0], light[1], light[2]);
-		glprog->use(); // Activate the shader program
 		_state = DEPTH;
+		glprog = nullptr;
+		glFailed = false;
 	}
 	else
 		_state = CPUDEPTH;
+	refresh();
 }
 //D =1−log(z / z−min) / log(z−max / z−min) if z < zc and log(z / z+max) / log(z+min / z+max) if z > zc
 // z±min = zc ± zmin and z±max = zc ± r*zmin
@@ -82,92 +98,170 @@ void XToon::setForFocus(float* zfocal, float* zmin, float* zmax, bool enableShad
 	this->_zmax = zmax;
 	this->_zmin = zmin;
 	this->_zc = zfocal;
-	this->zmin = *_zmin;
-	this->zmax = *_zmax;
-	this->zc = *_zc;
 	if (enableShader){
-		initProgram("shader.vert", "XToon_focus.frag");
-		glprog->setUniform1f("zmin", this->zmin);
-		glprog->setUniform1f("zmax", this->zmax);
-		glprog->setUniform1f("zfoc", this->zc);
-		glprog->setUniform3f("light", light[0], light[1], light[2]);
-		glprog->use(); // Activate the shader program
 		_state = FOCUS;
+		glprog = nullptr;
+		glFailed = false;
 	}
 	else
 		_state = CPUFOCUS;
+	refresh();
 }
 //D = |n*v|^r
 void XToon::setForSilhouette(float* r, bool enableShader){
 	this->_zc = r;
-	this->zc = *_zc;
 	if (enableShader){
-		initProgram("shader.vert", "XToon_silhouette.frag");
-		glprog->setUniform1f("r", this->zc);
-		glprog->setUniform3f("light", light[0], light[1], light[2]);
-		glprog->use(); // Activate the shader program
 		_state = SILHOUETTE;
+		glprog = nullptr;
+		glFailed = false;
 	}
 	else
 		_state = CPUSILHOUETTE;
+	refresh();
 }
 //D = |r*v|^s
 void XToon::setForHighlight(float* s, bool enableShader){
 	this->_zc = s;
-	this->zc = *_zc;
 	if (enableShader){
-		initProgram("shader.vert", "XToon_highlight.frag");
-		glprog->setUniform1f("s", this->zc);
-		glprog->setUniform3f("light", light[0], light[1], light[2]);
-		glprog->use(); // Activate the shader program
 		_state = HIGHLIGHT;
+		glprog = nullptr;
+		glFailed = false;
 	}
 	else
 		_state = CPUHIGHLIGHT;
+	refresh();
+}
+
+void XToon::approxMath(bool enable){
+	approx = enable;
+	//GPU modes need the matching shader variant
+	switch (_state){
+	case XToon::DEPTH:
+		setForDepth(_zmin, _zmax);
+		break;
+	case XToon::FOCUS:
+		setForFocus(_zc, _zmin, _zmax);
+		break;
+	case XToon::SILHOUETTE:
+		setForSilhouette(_zc);
+		break;
+	case XToon::HIGHLIGHT:
+		setForHighlight(_zc);
+		break;
+	default:
+		refresh();
+	}
+}
+
+bool XToon::approxMath(){
+	return approx;
 }
 
 void XToon::refresh(){
 	switch (_state){
 	case XToon::DEPTH:
+	case XToon::CPUDEPTH:
 		refreshForDepth();
 		break;
 	case XToon::FOCUS:
+	case XToon::CPUFOCUS:
 		refreshForFocus();
 		break;
 	case XToon::SILHOUETTE:
+	case XToon::CPUSILHOUETTE:
 		refreshForSilhouette();
 		break;
 	case XToon::HIGHLIGHT:
+	case XToon::CPUHIGHLIGHT:
 		refreshForHighlight();
 		break;
 	default:
-		zmin = *_zmin;
-		zmax = *_zmax;
-		zc = *_zc;
+		break;
 	}
 }
 
+//read the parameters, and upload them when the mode runs on the GPU
 void XToon::refreshForDepth(){
 	zmin = *_zmin;
 	zmax = *_zmax;
-	glprog->setUniform1f("zmin", zmin);
-	glprog->setUniform1f("zmax", zmax);
+	updateApprox();
+	if (_state != DEPTH || !useProgram(XToonPrograms::DEPTH))
+		return;
+	if (approxOK)
+		glprog->set(uniforms.logdepth, logDepth[0], logDepth[1]);
+	else {
+		glprog->set(uniforms.zmin, zmin);
+		glprog->set(uniforms.zmax, zmax);
+	}
 }
 void XToon::refreshForFocus(){
 	zmin = *_zmin;
 	zmax = *_zmax;
 	zc = *_zc;
-	glprog->setUniform1f("zmin", zmin);
-	glprog->setUniform1f("zmax", zmax);
-	glprog->setUniform1f("zfoc", zc);
+	updateApprox();
+	if (_state != FOCUS || !useProgram(XToonPrograms::FOCUS))
+		return;
+	glprog->set(uniforms.zmin, zmin);
+	glprog->set(uniforms.zmax, zmax);
+	glprog->set(uniforms.zfoc, zc);
+	if (approxOK){
+		glprog->set(uniforms.lognear, logNear[0], logNear[1]);
+		glprog->set(uniforms.logfar, logFar[0], logFar[1]);
+	}
 }
 void XToon::refreshForSilhouette(){
 	zc = *_zc;
-	glprog->setUniform1f("r", this->zc);
+	updateApprox();
+	if (_state == SILHOUETTE && useProgram(XToonPrograms::SILHOUETTE))
+		glprog->set(uniforms.r, this->zc);
 }
 void XToon::refreshForHighlight(){
 	zc = *_zc;
-	glprog->setUniform1f("s", this->zc);
+	updateApprox();
+	if (_state == HIGHLIGHT && useProgram(XToonPrograms::HIGHLIGHT))
+		glprog->set(uniforms.s, this->zc);
+}
+
+//bound of the GLSL log2 the approximate shader variant uses, for the GPU depth and focus
+//modes: GLSL 1.30 and later require 3 ULP (2^-21 absolute in [0.5, 2]), so below 3e-6 for
+//|log2 z| < 16; GLSL 1.10 leaves it open, it is taken for it too. The exact variant's log
+//is specified by the same bound
+static const float GLSL_LOG2_ERROR = 3e-6f;
+
+//log2 constants of the approximate detail functions (shared with the shader variants),
+//and whether their error stays below half a texture row for the current parameters: with
+//the fastLog2 / fastExp2 bounds for the CPU modes, the GLSL one for the GPU depth and focus
+//modes, which bind the exact program when it does not. The GPU silhouette and highlight
+//have no approximate program (XToonPrograms::hasApprox).
+//Half of that 1/512 budget goes to the log2/exp2 error, the rest covers float rounding.
+void XToon::updateApprox(){
+	const double budget = 1. / 1024.;
+	approxOK = false;
+	if (!approx)
+		return;
+	double log2Error = _state == DEPTH || _state == FOCUS ? GLSL_LOG2_ERROR : FAST_LOG2_ERROR;
+	switch (_state){
+	case XToon::DEPTH:
+	case XToon::CPUDEPTH:
+		logDepth[0] = (float)log2((double)zmin);
+		logDepth[1] = (float)(1. / log2((double)(zmax / zmin)));
+		approxOK = log2Error * fabs(logDepth[1]) < budget;
+		break;
+	case XToon::FOCUS:
+	case XToon::CPUFOCUS:
+		logNear[0] = (float)log2((double)(zc - zmin));
+		logNear[1] = (float)(1. / log2((double)((zc - zmax) / (zc - zmin))));
+		logFar[0] = (float)log2((double)(zc + zmax));
+		logFar[1] = (float)(1. / log2((double)((zc + zmin) / (zc + zmax))));
+		approxOK = log2Error * max(fabs(logNear[1]), fabs(logFar[1])) < budget;
+		break;
+	case XToon::CPUSILHOUETTE:
+	case XToon::CPUHIGHLIGHT:
+		approxOK = zc >= 0 && zc * 0.6931472 * log2Error + FAST_EXP2_ERROR < budget;
+		break;
+	default:
+		break;
+	}
 }
 
 //return value between 0..1
@@ -177,17 +271,27 @@ float XToon::getLambertian(const Vec3f& p, const Vec3f& n) {
 
 //return value between 0..1, used after proper set and for the get function below 
 float XToon::getForDepth(const Vec3f& p){
-	float z = camera->getZ(p);
-	return 1 - log(z / zmin) / log(zmax / zmin);
+	return depthFromZ(frame().getZ(p));
 }
 float XToon::getForFocus(const Vec3f& p){
-	Vec3f campos;
-	camera->getPos(campos);
-	float z = (p - campos).length();
+	return focusFromZ((p - frame().pos).length());
+}
+
+//detail transfer functions shared by the per-vertex and batched paths
+float XToon::depthFromZ(float z){
+	if (approxOK)
+		return 1 - (fastLog2(z) - logDepth[0]) * logDepth[1];
+	return 1 - log(z / zmin) / log(zmax / zmin);
+}
+float XToon::focusFromZ(float z){
 	if (z > zc+zmin){
+		if (approxOK)
+			return (fastLog2(z) - logFar[0]) * logFar[1];
 		return log(z / (zc + zmax)) / log((zc + zmin) / (zc + zmax));
 	}
 	else if (z < zc-zmin){
+		if (approxOK)
+			return 1 - (fastLog2(z) - logNear[0]) * logNear[1];
 		return 1 - log(z / (zc - zmin)) / log((zc - zmax) / (zc - zmin));
 	}
 	else{
@@ -197,20 +301,22 @@ float XToon::getForFocus(const Vec3f& p){
 
 // n normal, v normalized view vector
 float XToon::getForSilhouette(const Vec3f& p, const Vec3f& n){
-	Vec3f campos;
-	camera->getPos(campos);
-	Vec3f v = normalize(campos - p);
-	return pow(abs(dot(n, v)), zc);
+	Vec3f v = normalize(frame().pos - p);
+	return powFromDot(abs(dot(n, v)));
 }
 
 // n normal, v normalized view vector
 float XToon::getForHighlight(const Vec3f& p, const Vec3f& n){
-	Vec3f campos;
-	camera->getPos(campos);
-	Vec3f v = normalize(campos - p);
+	Vec3f v = normalize(frame().pos - p);
 	Vec3f l = normalize(lightPos() - p);
 	Vec3f r = dot(n, l)*n + cross(cross(l, n), n);
-	return pow(abs(dot(r, v)), zc);
+	return powFromDot(abs(dot(r, v)));
+}
+
+float XToon::powFromDot(float a){
+	if (approxOK)
+		return fastPow(a, zc);
+	return pow(a, zc);
 }
 
 Vec3f XToon::get(const Vec3f& p, const Vec3f& n, float dim2){
@@ -218,16 +324,20 @@ Vec3f XToon::get(const Vec3f& p, const Vec3f& n, float dim2){
 }
 
 Vec3f XToon::get(float dim1, float dim2){
-	int i = (int)(min(max(dim2,0.f),1.f) * (256. - 0.000000001)),
-		j = (int)(min(max(dim1,0.f),1.f) * (256. - 0.000000001));
-	return bTof(get(i,j));
+	float rgb[3];
+	fetch(dim1, dim2, rgb);
+	return Vec3f(rgb[0], rgb[1], rgb[2]);
 }
 
 Vec3b XToon::get(int w, int h){
-	RGBApixel* p = texture(h,w);
-	return Vec3b(p->Red, p->Green, p->Blue);
+	unsigned int p = lut.rgba8(w, h);
+	return Vec3b(p & 0xff, (p >> 8) & 0xff, (p >> 16) & 0xff);
+}
+
+void XToon::bilinearSampling(bool enable){
+	bilinear = enable;
 }
 
-Vec3f XToon::bTof(const Vec3b& in){
-	return Vec3f(in[0] / 255.f, in[1] / 255.f, in[2] / 255.f);
+bool XToon::bilinearSampling(){
+	return bilinear;
 }
@@ -7,6 +7,10 @@
 #include "Vec3.h"
 #include "Camera.h"
 #include "GLProgram.h"
+#include "XToonPrograms.h"
+#include "ToonLUT.h"
+
+class ThreadPool;
 
 class XToon
 {
@@ -33,6 +37,18 @@ public:
 	//refresh shader parameters in GPU.
 	void refresh();
 
+	//approximate math for the detail functions (fast log2/exp2, see FastMath.h)
+	//--  CPU: the texture row stays within half a row of the exact one, parameters
+	//--  for which this cannot be guaranteed fall back to the exact functions
+	//--  GPU: the log2 variant of the depth and focus shaders, bound under the same half
+	//--  row condition with the precision GLSL gives log2, the exact one otherwise
+	void approxMath(bool enable);
+	bool approxMath();
+
+	//bilinear instead of nearest texel lookup for the CPU modes
+	void bilinearSampling(bool enable);
+	bool bilinearSampling();
+
 	//1st dimension value for shader by CPU
 	//--  return value between 0..1
 	float getLambertian(const Vec3f& p, const Vec3f& n);
@@ -50,21 +66,55 @@ public:
 	Vec3f get(const Vec3f& p, const Vec3f& n, float dim2);
 	Vec3f get(float dim1, float dim2);
 	Vec3b get(int w, int h);
+
+	//batched rendering by CPU over structure-of-arrays input, using the current CPU* state
+	//--  px,py,pz positions, nx,ny,nz normals, rgb receives count interleaved colours
+	//--  same result as get(p, n, getFor*(...)) called per vertex, FMA contraction being
+	//--  off in both (FPContract.h)
+	//--  the vertices are split across the pool when one is given
+	void getBatch(unsigned int count, const float* px, const float* py, const float* pz,
+		const float* nx, const float* ny, const float* nz, float* rgb, ThreadPool* pool = nullptr);
+	//refresh the camera snapshot now, so that getBatch can then be called from several threads at once
+	void beginFrame();
+
 	Vec3f lightPos();
 	void lightPos(const Vec3f& l);
 
 private:
 	ShaderState _state = NONE;
-	Program * glprog = nullptr;
+	XToonPrograms programs;	//built on the first GPU mode set
+	Program * glprog = nullptr;	//program of the current GPU mode
+	XToonPrograms::Uniforms uniforms;	//and its uniforms
 	BMP texture;
-	EasyBMP_Texture BMPtexture;
-	GLuint texName; // Identifiant opengl de la texture
-	float *_zmax, *_zmin , *_zc;
+	ToonLUT lut;	//texture converted for the CPU lookups
+	bool bilinear = false;
+	float *_zmax = nullptr, *_zmin = nullptr, *_zc = nullptr;
 	float zmax, zmin, zc;
+	bool approx = false;	//approximate math requested
+	bool approxOK = false;	//and within its error bound for the current parameters
+	bool glApprox = false;	//math variant of glprog
+	bool glFailed = false;	//the programs failed to build since the last setFor*
+	float logDepth[2], logNear[2], logFar[2];	//log2 of the reference depth, 1/log2 of the range
+	void updateApprox();
 	Vec3f light;
 	Camera* camera;
-	bool initProgram(const std::string& vert, const std::string& frag);
-	Vec3f bTof(const Vec3b& in);
+	CameraState view;	//camera snapshot the CPU getters read from
+	Vec3f viewLight;	//light position in model space for that snapshot
+	bool viewDirty = true;
+	const CameraState& frame();
+	struct BatchFrame;
+	void shadeRange(const BatchFrame& f, unsigned int count, const float* px, const float* py, const float* pz,
+		const float* nx, const float* ny, const float* nz, float* rgb);
+	bool useProgram(XToonPrograms::Mode mode);
+	inline void fetch(float dim1, float dim2, float* rgb){
+		if (bilinear)
+			lut.sampleBilinear(dim1, dim2, rgb);
+		else
+			lut.sample(dim1, dim2, rgb);
+	}
+	float depthFromZ(float z);
+	float focusFromZ(float z);
+	float powFromDot(float a);
 	void refreshForDepth();
 	void refreshForFocus();
 	void refreshForSilhouette();
@@ -0,0 +1,152 @@
+#include "FPContract.h"
+#include "XToon.h"
+#include "SIMD.h"
+#include "FastMath.h"
+#include "ThreadPool.h"
+#include <cmath>
+
+using namespace std;
+
+// Batched CPU shading.
+// The geometric part of every detail function (normalisations, dot and cross
+// products, view depth) runs vfloat::width vertices at a time, following the
+// exact operation order of the per-vertex getters; the log/pow transfer and
+// the texel fetch are then applied lane by lane. With approximate math the
+// transfer runs on the lanes too (same FastMath.h template as the getters).
+// The identity needs contraction off here and in XToon.cpp, see FPContract.h.
+
+//per-frame constants of the kernels
+struct XToon::BatchFrame {
+	vfloat3 light;	//light position in model space
+	vfloat3 campos;
+	vfloat3 zdir;
+	vfloat zoom;
+};
+
+namespace {
+	const int W = vfloat::width;
+
+	//lanes [i, i+W) of a stream, the tail padded with the last element
+	inline vfloat loadLanes(const float* a, unsigned int i, unsigned int count){
+		if (i + W <= count)
+			return vfloat::load(a + i);
+		float tmp[W];
+		for (int k = 0; k < W; k++)
+			tmp[k] = a[min(i + k, count - 1)];
+		return vfloat::load(tmp);
+	}
+
+	inline vfloat3 splat(const Vec3f& v){
+		return vfloat3(vfloat(v[0]), vfloat(v[1]), vfloat(v[2]));
+	}
+
+	//D = 1−log(z/zmin)/log(zmax/zmin) : z lanes, same steps as Camera::getZ
+	inline vfloat depthKernel(vfloat zoom, const vfloat3& zdir, const vfloat3& p){
+		return zoom - zdir.x * p.x - zdir.y * p.y - zdir.z * p.z;
+	}
+	//focus : distance to the eye
+	inline vfloat focusKernel(const vfloat3& campos, const vfloat3& p){
+		return length(p - campos);
+	}
+	//D = |n*v|^r : |n*v| lanes
+	inline vfloat silhouetteKernel(const vfloat3& campos, const vfloat3& p, const vfloat3& n){
+		vfloat3 v = normalize(campos - p);
+		return vabs(dot(n, v));
+	}
+	//D = |r*v|^s : |r*v| lanes
+	inline vfloat highlightKernel(const vfloat3& campos, const vfloat3& light, const vfloat3& p, const vfloat3& n){
+		vfloat3 v = normalize(campos - p);
+		vfloat3 l = normalize(light - p);
+		vfloat3 r = n * dot(n, l) + cross(cross(l, n), n);
+		return vabs(dot(r, v));
+	}
+}
+
+void XToon::getBatch(unsigned int count, const float* px, const float* py, const float* pz,
+	const float* nx, const float* ny, const float* nz, float* rgb, ThreadPool* pool){
+	if (count == 0)
+		return;
+	//the snapshot is refreshed here, the workers below only read it
+	const CameraState& s = frame();
+	BatchFrame f;
+	f.light = splat(viewLight);
+	f.campos = splat(s.pos);
+	f.zdir = splat(s.zdir);
+	f.zoom = vfloat(s.zoom);
+
+	if (pool == nullptr){
+		shadeRange(f, count, px, py, pz, nx, ny, nz, rgb);
+		return;
+	}
+	//chunk boundaries on whole cache lines of the rgb output
+	unsigned int grain = ThreadPool::alignedGrain(2048, 3 * sizeof(float));
+	pool->parallelFor(count, grain, [&](unsigned int begin, unsigned int end){
+		shadeRange(f, end - begin, px + begin, py + begin, pz + begin,
+			nx + begin, ny + begin, nz + begin, rgb + 3 * begin);
+	});
+}
+
+void XToon::shadeRange(const BatchFrame& f, unsigned int count, const float* px, const float* py, const float* pz,
+	const float* nx, const float* ny, const float* nz, float* rgb){
+	float dim1[W], geo[W];
+	for (unsigned int i = 0; i < count; i += W){
+		vfloat3 p(loadLanes(px, i, count), loadLanes(py, i, count), loadLanes(pz, i, count));
+		vfloat3 n(loadLanes(nx, i, count), loadLanes(ny, i, count), loadLanes(nz, i, count));
+
+		vmax(vfloat(0.f), dot(normalize(f.light - p), n)).store(dim1);
+		switch (_state){
+		case CPUDEPTH:
+			depthKernel(f.zoom, f.zdir, p).store(geo);
+			break;
+		case CPUFOCUS:
+			focusKernel(f.campos, p).store(geo);
+			break;
+		case CPUSILHOUETTE:
+			silhouetteKernel(f.campos, p, n).store(geo);
+			break;
+		case CPUHIGHLIGHT:
+			highlightKernel(f.campos, f.light, p, n).store(geo);
+			break;
+		default:
+			return;
+		}
+		if (approxOK){
+			//lane version of the approximate depthFromZ / focusFromZ / powFromDot
+			vfloat g = vfloat::load(geo);
+			switch (_state){
+			case CPUDEPTH:
+				g = vfloat(1.f) - (fastLog2(g) - vfloat(logDepth[0])) * vfloat(logDepth[1]);
+				break;
+			case CPUFOCUS:{
+				vfloat l = fastLog2(g);
+				vfloat dfar = (l - vfloat(logFar[0])) * vfloat(logFar[1]);
+				vfloat dnear = vfloat(1.f) - (l - vfloat(logNear[0])) * vfloat(logNear[1]);
+				g = select(g > vfloat(zc + zmin), dfar, select(g < vfloat(zc - zmin), dnear, vfloat(1.f)));
+				break;
+			}
+			default:
+				g = fastPow(g, zc);
+			}
+			g.store(geo);
+		}
+
+		unsigned int lanes = min((unsigned int)W, count - i);
+		for (unsigned int k = 0; k < lanes; k++){
+			float dim2;
+			if (approxOK)
+				dim2 = geo[k];
+			else switch (_state){
+			case CPUDEPTH:
+				dim2 = depthFromZ(geo[k]);
+				break;
+			case CPUFOCUS:
+				dim2 = focusFromZ(geo[k]);
+				break;
+			default:
+				dim2 = pow(geo[k], zc);
+			}
+			fetch(dim1[k], dim2, rgb + 3 * (i + k));
+		}
+	}
+}
+
@@ -0,0 +1,130 @@
+#include "XToonPrograms.h"
+#include <algorithm>
+#include "EasyBMP/EasyBMP_OpenGL.h"
+
+using namespace std;
+
+const char* const XToonPrograms::FRAGMENT_FILES[NUM_MODES] = {
+	"XToon_depth.frag", "XToon_focus.frag", "XToon_silhouette.frag", "XToon_highlight.frag"
+};
+
+XToonPrograms::XToonPrograms(){
+	for (int a = 0; a < 2; a++)
+		for (int m = 0; m < NUM_MODES; m++)
+			fragments[a][m] = nullptr;
+}
+
+//nothing to release without a context: the objects are only made by build()
+XToonPrograms::~XToonPrograms(){
+	for (int a = 0; a < 2; a++)
+		for (int m = 0; m < NUM_MODES; m++){
+			delete variants[a][m].program;
+			delete fragments[a][m];
+		}
+	delete vertex;
+	if (texName != 0)
+		glDeleteTextures(1, &texName);
+}
+
+void XToonPrograms::build(BMP& texture, bool approx){
+	if (texName == 0){
+		EasyBMP_Texture image;
+		image.ImportBMP(texture);
+		glGenTextures(1, &texName);
+		glBindTexture(GL_TEXTURE_2D, texName);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.TellWidth(), image.TellHeight(), 0, GL_RGB, GL_UNSIGNED_BYTE, image.Texture);
+	}
+	if (built(approx))
+		return;
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xffffffff);
+
+	//take what the binary cache has, hand every other source and link over to the driver,
+	//then read the statuses
+	Shader** frag = fragments[approx];
+	Program* programs[NUM_MODES] = {};
+	bool cached[NUM_MODES], skip[NUM_MODES];
+	for (int m = 0; m < NUM_MODES; m++){
+		skip[m] = approx && !hasApprox((Mode)m);
+		cached[m] = skip[m];	//nothing to compile either
+	}
+	try {
+		if (vertex == nullptr){
+			vertex = new Shader("X-Toon Vertex Shader", GL_VERTEX_SHADER);
+			vertex->loadFromFile("shader.vert");
+		}
+		for (int m = 0; m < NUM_MODES; m++){
+			if (skip[m])
+				continue;
+			frag[m] = new Shader(string("X-Toon Fragment Shader ") + FRAGMENT_FILES[m], GL_FRAGMENT_SHADER);
+			frag[m]->setDefines(approx ? "#define XTOON_APPROX\n" : "");
+			frag[m]->loadFromFile(FRAGMENT_FILES[m]);
+			programs[m] = new Program(string("X-Toon ") + FRAGMENT_FILES[m]);
+			programs[m]->attach(vertex);
+			programs[m]->attach(frag[m]);
+			cached[m] = programs[m]->loadBinary();
+		}
+		bool compileVertex = !vertexCompiled && find(cached, cached + NUM_MODES, false) != cached + NUM_MODES;
+		if (compileVertex)
+			vertex->startCompile();
+		for (int m = 0; m < NUM_MODES; m++)
+			if (!cached[m])
+				frag[m]->startCompile();
+		for (int m = 0; m < NUM_MODES; m++)
+			if (!cached[m])
+				programs[m]->startLink();
+		if (compileVertex){
+			vertex->checkCompile();
+			vertexCompiled = true;
+		}
+		for (int m = 0; m < NUM_MODES; m++)
+			if (!cached[m])
+				frag[m]->checkCompile();
+		for (int m = 0; m < NUM_MODES; m++)
+			if (!cached[m]){
+				programs[m]->checkLink();
+				programs[m]->saveBinary();
+			}
+	}
+	catch (Exception&){
+		for (int m = 0; m < NUM_MODES; m++){
+			delete programs[m];
+			delete frag[m];
+			frag[m] = nullptr;
+		}
+		throw;
+	}
+
+	for (int m = 0; m < NUM_MODES; m++){
+		Program* p = programs[m];
+		if (p == nullptr)
+			continue;
+		Uniforms& u = variants[approx][m].uniforms;
+		u.texsample = p->uniform<int, 1>("texsample");
+		u.light = p->uniform<float, 3>("light");
+		u.zmin = p->uniform<float, 1>("zmin");
+		u.zmax = p->uniform<float, 1>("zmax");
+		u.zfoc = p->uniform<float, 1>("zfoc");
+		u.r = p->uniform<float, 1>("r");
+		u.s = p->uniform<float, 1>("s");
+		u.logdepth = p->uniform<float, 2>("logdepth");
+		u.lognear = p->uniform<float, 2>("lognear");
+		u.logfar = p->uniform<float, 2>("logfar");
+		p->set(u.texsample, 0);
+		variants[approx][m].program = p;
+	}
+}
+
+const XToonPrograms::Variant& XToonPrograms::bind(Mode mode, bool approx){
+	const Variant& v = variants[approx][mode];
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texName);
+	v.program->use();
+	return v;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <GL/glew.h>
+#include "EasyBMP/EasyBMP.h"
+#include "GLProgram.h"
+
+/// The GL objects of the X-Toon GPU modes, made once per context instead of on every
+/// XToon::setFor*: the toon texture, uploaded once, and one program per mode and math
+/// variant, all sharing one vertex shader.
+/// The programs of a variant are taken from the binary cache of Program when it has
+/// them; the others are compiled and linked together before any status is read, so that a
+/// driver compiling in parallel (KHR/ARB_parallel_shader_compile) works on all of them at
+/// once. The approximate math variant is built the first time it is asked for; it only
+/// has the depth and focus modes, whose log() it rewrites with log2 and constants: pow
+/// has no cheaper form in GLSL, silhouette and highlight keep their exact program.
+/// Switching mode is then binding a program built already, with the handles on its
+/// uniforms resolved at link time: no allocation, no GL object made.
+class XToonPrograms {
+public:
+	enum Mode { DEPTH, FOCUS, SILHOUETTE, HIGHLIGHT, NUM_MODES };
+
+	//handles on the uniforms of a program, invalid for those its shaders do not declare
+	struct Uniforms {
+		Uniform<int> texsample;
+		Uniform<float, 3> light;
+		Uniform<float> zmin, zmax, zfoc, r, s;
+		Uniform<float, 2> logdepth, lognear, logfar;
+	};
+	struct Variant {
+		Program* program = nullptr;
+		Uniforms uniforms;
+	};
+
+	XToonPrograms();
+	~XToonPrograms();
+
+	//upload texture on the first call, then build the programs of the variant unless done
+	//already; throws Exception (GLProgram.h) on a shader error, leaving nothing of the variant
+	void build(BMP& texture, bool approx);
+	inline bool built(bool approx) const { return variants[approx][0].program != nullptr; }
+	//make the program of mode and variant, built already, current with the texture; the
+	//approximate variant has no program for the modes without hasApprox
+	const Variant& bind(Mode mode, bool approx);
+	static inline bool hasApprox(Mode mode) { return mode == DEPTH || mode == FOCUS; }
+
+private:
+	static const char* const FRAGMENT_FILES[NUM_MODES];
+
+	GLuint texName = 0;
+	Shader* vertex = nullptr;
+	bool vertexCompiled = false;
+	Shader* fragments[2][NUM_MODES];
+	Variant variants[2][NUM_MODES];
+
+	XToonPrograms(const XToonPrograms&);
+	XToonPrograms& operator=(const XToonPrograms&);
+};
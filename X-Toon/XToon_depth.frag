@@ -1,6 +1,10 @@
 uniform vec3 light;
+#ifdef XTOON_APPROX
+uniform vec2 logdepth; // log2(zmin), 1/log2(zmax/zmin)
+#else
 uniform float zmin;
 uniform float zmax;
+#endif
 uniform sampler2D texsample;
 
 varying vec4 P; // fragment-wise position
@@ -12,6 +16,12 @@ void main (void) {
 
 	float zed = - p.z;
 	float f1 = max(dot(normalize(light - p), n), 0.005);
+#ifdef XTOON_APPROX
+	// built-in log2 within 3 ULP; XToon::updateApprox binds this variant only where that,
+	// times logdepth.y, stays under half a texel row
+	float f2 = clamp(1. - (log2(zed) - logdepth.x) * logdepth.y, 0.005, 0.995);
+#else
 	float f2 = clamp(1. - log(zed / zmin) / log(zmax / zmin), 0.005, 0.995);
+#endif
 	gl_FragColor = texture2D(texsample, vec2(f1, 1. - f2)); 
 }
\ No newline at end of file
@@ -2,18 +2,33 @@ uniform vec3 light;
 uniform float zfoc;
 uniform float zmin;
 uniform float zmax;
+#ifdef XTOON_APPROX
+uniform vec2 lognear; // log2(z-min), 1/log2(z-max/z-min)
+uniform vec2 logfar; // log2(z+max), 1/log2(z+min/z+max)
+#endif
 uniform sampler2D texsample;
 
 varying vec4 P; // fragment-wise position
 varying vec3 N; // fragment-wise normal
 
 float getFocus(float z){
+#ifdef XTOON_APPROX
+	// built-in log2; bound by XToon::updateApprox only while its 3 ULP, scaled by
+	// lognear.y and logfar.y, keep the row within half a row of the log() branch
+	if (z > zfoc + zmin){
+		return (log2(z) - logfar.x) * logfar.y;
+	}
+	else if(z < zfoc - zmin){
+		return 1. - (log2(z) - lognear.x) * lognear.y;
+	}
+#else
 	if (z > zfoc + zmin){
 		return log(z / (zfoc + zmax)) / log((zfoc + zmin) / (zfoc + zmax));
 	}
 	else if(z < zfoc - zmin){
 		return 1. - log(z / (zfoc - zmin)) / log((zfoc - zmax) / (zfoc - zmin));
 	}
+#endif
 	else {
 		return 1.;
 	}